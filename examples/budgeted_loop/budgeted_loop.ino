@@ -0,0 +1,54 @@
+/*
+*  SSDP shares the main loop with other work: loop(budget_us) takes at most about SSDP_BUDGET_US
+*  per call, and the rest of the work waits in the backlog until the next call.
+*  The backlog and its maximum are printed once per second (see budgeted_loop_test.py).
+*/
+
+#include <ESP8266WiFi.h>
+#include <almilukESP8266SSDP.h>
+
+#define NETNAME ""
+#define PASSWORD ""
+
+#define SSDP_BUDGET_US 2000
+
+uint16_t g_maxBacklog = 0;
+unsigned long g_printTime = 0;
+
+void setup() {
+	Serial.begin(115200);
+
+	WiFi.mode(WIFI_STA);
+	WiFi.begin(NETNAME, PASSWORD);
+	Serial.print("Waiting for WiFi connection");
+	while (!WiFi.localIP().isSet()) {
+		Serial.print('.');
+		delay(500);
+	}
+	Serial.println("\nConnected to WiFi");
+
+	SSDP.setDeviceType("almiluk-domain", "esp8266-ssdp-test", "1.0");
+	SSDP.setName("myESP");
+	SSDP.setSchemaURL("ssdp/schema.xml");
+
+	if (SSDP.begin())
+		Serial.println("SSDP begun");
+	else
+		Serial.println("SSDP init failed");
+}
+
+void loop() {
+	SSDP.loop(SSDP_BUDGET_US);
+
+	uint16_t backlog = SSDP.getBacklog();
+	if (backlog > g_maxBacklog)
+		g_maxBacklog = backlog;
+	if (millis() - g_printTime >= 1000) {
+		g_printTime = millis();
+		Serial.printf("backlog: %u max: %u\n", backlog, g_maxBacklog);
+		g_maxBacklog = 0;
+	}
+
+	// Other work of the sketch
+	delay(10);
+}
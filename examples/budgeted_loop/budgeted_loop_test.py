@@ -0,0 +1,111 @@
+import argparse
+import re
+import select
+import socket
+import threading
+from time import monotonic, sleep
+
+
+SSDP_ADDR = "239.255.255.250";
+SSDP_PORT = 1900;
+
+device_domain = "almiluk-domain"
+device_type = "esp8266-ssdp-test"
+device_version = "1.0"
+
+# Searches from the same address and port are answered once, so they are sent from several sockets
+REQUESTERS_NUM = 8
+
+
+def flood(rate, duration, mx) -> tuple:
+    """Sends searches for the device type at the rate (per second), returns (sent, answered) numbers."""
+    socks = []
+    for _ in range(REQUESTERS_NUM):
+        sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM, socket.IPPROTO_UDP)
+        sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_TTL, 5)
+        sock.bind(('', 0))
+        socks.append(sock)
+
+    st = f"urn:{device_domain}:device:{device_type}:{device_version}"
+    ssdpRequest = ("M-SEARCH * HTTP/1.1\r\n"
+                + "HOST: %s:%d\r\n" % (SSDP_ADDR, SSDP_PORT)
+                + "MAN: \"ssdp:discover\"\r\n"
+                + "MX: %d\r\n" % (mx, )
+                + "ST: %s\r\n" % (st, ) + "\r\n")
+
+    sent = 0
+    answered = 0
+    start = monotonic()
+    # Responses come up to MX seconds after the last search
+    end = start + duration + mx + 1
+    while True:
+        now = monotonic()
+        if now >= end:
+            break
+        if now - start < duration and sent < (now - start) * rate:
+            socks[sent % REQUESTERS_NUM].sendto(ssdpRequest.encode(), (SSDP_ADDR, SSDP_PORT))
+            sent += 1
+        ready, _, _ = select.select(socks, [], [], min(1.0 / rate, end - now))
+        for sock in ready:
+            data, _ = sock.recvfrom(10240)
+            if data.startswith(b"HTTP/1.1 200 OK") and st.encode() in data:
+                answered += 1
+
+    for sock in socks:
+        sock.close()
+    return sent, answered
+
+
+def read_backlog(port, lines, stop):
+    """Collects (time, backlog, max) from the lines the device prints once per second."""
+    pattern = re.compile(r"backlog: (\d+) max: (\d+)")
+    while not stop.is_set():
+        line = port.readline().decode(errors="replace")
+        match = pattern.search(line)
+        if match:
+            lines.append((monotonic(), int(match.group(1)), int(match.group(2))))
+            print(line.strip())
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Floods examples/budgeted_loop with searches "
+        "and checks that its backlog drains after the flood.")
+    parser.add_argument("--serial", help="serial port of the device to read its backlog (requires pyserial)")
+    parser.add_argument("-b", "--baudrate", type=int, default=115200)
+    parser.add_argument("--rate", type=float, default=20, help="searches per second")
+    parser.add_argument("--duration", type=float, default=5, help="seconds of the flood")
+    parser.add_argument("--mx", type=int, default=1)
+    args = parser.parse_args()
+
+    port = None
+    lines = []
+    stop = threading.Event()
+    if args.serial:
+        import serial as pyserial
+        port = pyserial.Serial(args.serial, args.baudrate, timeout=1)
+        threading.Thread(target=read_backlog, args=(port, lines, stop), daemon=True).start()
+
+    print("Flooding with %.0f searches per second for %.0f s..." % (args.rate, args.duration))
+    start = monotonic()
+    sent, answered = flood(args.rate, args.duration, args.mx)
+    flood_end = start + args.duration
+    print("Searches: %d, answered: %d" % (sent, answered))
+    results = [("Searches answered", answered > 0)]
+
+    if port:
+        # The device prints the backlog once per second
+        sleep(2)
+        stop.set()
+        port.close()
+        peak = max((max_backlog for time, _, max_backlog in lines if time <= flood_end + 1), default=0)
+        last = [backlog for time, backlog, _ in lines if time > flood_end + args.mx + 1]
+        print("Peak backlog during the flood: %d, backlog after it: %s" % (peak, last))
+        results.append(("Backlog drained", bool(last) and last[-1] == 0))
+
+    print()
+    for name, passed in results:
+        print("%s: %s" % (name, "passed" if passed else "FAILED"))
+
+
+if __name__ == '__main__':
+    main()
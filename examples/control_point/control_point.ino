@@ -0,0 +1,53 @@
+/*
+*  The device searches for UPnP devices and prints their descriptions.
+*  Descriptions are fetched only for new devices and for devices with changed CONFIGID.
+*/
+
+#include <ESP8266WiFi.h>
+#include <almilukESP8266SSDP.h>
+#include <SSDPDescriptionFetcher.h>
+
+#define NETNAME ""
+#define PASSWORD ""
+
+SSDPDescriptionFetcher g_fetcher;
+unsigned long g_searchTime = 0;
+
+void setup() {
+	Serial.begin(115200);
+
+	WiFi.mode(WIFI_STA);
+	WiFi.begin(NETNAME, PASSWORD);
+	Serial.print("Waiting for WiFi connection");
+	while (!WiFi.localIP().isSet()) {
+		Serial.print('.');
+		delay(500);
+	}
+	Serial.println("\nConnected to WiFi");
+
+	g_fetcher.onDescription([](const SSDPDeviceDescription& description) {
+		Serial.printf("%s (%s)\n", description.friendlyName, description.location);
+		Serial.printf("\ttype: %s\n\tUDN: %s\n\tconfigId: %d\n",
+			description.deviceType, description.udn, description.configId);
+		for (uint8_t i = 0; i < description.servicesNum; i++)
+			Serial.printf("\tservice: %s\n", description.serviceTypes[i]);
+	});
+	SSDP.setFetcher(&g_fetcher);
+
+	if (SSDP.begin())
+		Serial.println("SSDP begun");
+	else
+		Serial.println("SSDP init failed");
+}
+
+void loop() {
+	if (g_searchTime == 0 || millis() - g_searchTime > 60000) {
+		g_searchTime = millis();
+		SSDP.search("upnp:rootdevice");
+	}
+
+	SSDP.loop();
+	g_fetcher.loop();
+
+	delay(16);
+}
@@ -0,0 +1,123 @@
+import argparse
+import socket
+import threading
+import uuid
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+from time import sleep
+
+
+SSDP_ADDR = "239.255.255.250";
+SSDP_PORT = 1900;
+
+# SSDP_FETCH_RETRY_INTERVAL of the library, in seconds
+FETCH_RETRY_INTERVAL = 30
+
+device_uuid = "uuid:%s" % (uuid.uuid4(), )
+device_type = "urn:almiluk-domain:device:control-point-test:1"
+description_path = "/description.xml"
+broken_path = "/broken.xml"
+
+description = ("<?xml version=\"1.0\"?>\r\n"
+            + "<root xmlns=\"urn:schemas-upnp-org:device-1-0\">"
+            + "<specVersion><major>2</major><minor>0</minor></specVersion>"
+            + "<device>"
+            + "<deviceType>%s</deviceType>" % (device_type, )
+            + "<friendlyName>control_point_test</friendlyName>"
+            + "<UDN>%s</UDN>" % (device_uuid, )
+            + "<serviceList><service>"
+            + "<serviceType>urn:almiluk-domain:service:test:1</serviceType>"
+            + "</service></serviceList>"
+            + "</device></root>\r\n")
+
+# Number of GET requests for each path
+requests = {}
+
+
+class DescriptionHandler(BaseHTTPRequestHandler):
+    def do_GET(self):
+        requests[self.path] = requests.get(self.path, 0) + 1
+        print("GET %s from %s" % (self.path, self.client_address[0]))
+        if self.path != description_path:
+            self.send_error(500)
+            return
+        body = description.encode()
+        self.send_response(200)
+        self.send_header("Content-Type", "text/xml")
+        self.send_header("Content-Length", str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+    def log_message(self, format, *args):
+        pass
+
+
+def notify(sock, location, config_id, times=3):
+    """Announces the device several times, as devices do on startup."""
+    message = ("NOTIFY * HTTP/1.1\r\n"
+            + "HOST: %s:%d\r\n" % (SSDP_ADDR, SSDP_PORT)
+            + "CACHE-CONTROL: max-age=300\r\n"
+            + "LOCATION: %s\r\n" % (location, )
+            + "NT: upnp:rootdevice\r\n"
+            + "NTS: ssdp:alive\r\n"
+            + "SERVER: Linux/1.0 UPNP/2.0 control_point_test/1.0\r\n"
+            + "USN: %s::upnp:rootdevice\r\n" % (device_uuid, )
+            + "BOOTID.UPNP.ORG: 1\r\n"
+            + "CONFIGID.UPNP.ORG: %d\r\n" % (config_id, ) + "\r\n")
+    for _ in range(times):
+        sock.sendto(message.encode(), (SSDP_ADDR, SSDP_PORT))
+        sleep(0.5)
+
+
+def check(name, path, expected) -> bool:
+    # The device fetches in its loop(), give it time to finish
+    sleep(3)
+    got = requests.get(path, 0)
+    print("%s: %d/%d requests" % (name, got, expected))
+    return got == expected
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Tests description fetching of examples/control_point. "
+        "Watch the serial output of the device: each fetched description is printed once.")
+    parser.add_argument("--host", required=True, help="IP address of this host in the network of the device")
+    parser.add_argument("--port", type=int, default=8080, help="port of the HTTP server for descriptions")
+    args = parser.parse_args()
+
+    server = ThreadingHTTPServer((args.host, args.port), DescriptionHandler)
+    threading.Thread(target=server.serve_forever, daemon=True).start()
+    location = "http://%s:%d%s" % (args.host, args.port, description_path)
+    broken = "http://%s:%d%s" % (args.host, args.port, broken_path)
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM, socket.IPPROTO_UDP)
+    sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_IF, socket.inet_aton(args.host))
+    sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_TTL, 2)
+
+    results = []
+    print("\n\nRepeated announcements with the same CONFIGID...\n")
+    notify(sock, location, 1)
+    results.append(("One fetch per CONFIGID", check("CONFIGID 1", description_path, 1)))
+    notify(sock, location, 1)
+    results.append(("Known CONFIGID is not fetched", check("CONFIGID 1 again", description_path, 1)))
+
+    print("\n\nChanged CONFIGID...\n")
+    notify(sock, location, 2)
+    results.append(("Changed CONFIGID is fetched", check("CONFIGID 2", description_path, 2)))
+
+    print("\n\nFailed fetch is retried after %d s...\n" % (FETCH_RETRY_INTERVAL, ))
+    notify(sock, broken, 1)
+    results.append(("Failed location is fetched", check("Broken location", broken_path, 1)))
+    notify(sock, broken, 1)
+    results.append(("Failed location is not retried at once", check("Broken location again", broken_path, 1)))
+    sleep(FETCH_RETRY_INTERVAL)
+    notify(sock, broken, 1)
+    results.append(("Failed location is retried later", check("Broken location later", broken_path, 2)))
+
+    sock.close()
+    server.shutdown()
+    print()
+    for name, passed in results:
+        print("%s: %s" % (name, "passed" if passed else "FAILED"))
+
+
+if __name__ == '__main__':
+    main()
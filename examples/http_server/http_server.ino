@@ -0,0 +1,69 @@
+/*
+*  The description document and SCPD document of the service are served by built-in HTTP server,
+*  no web server is needed. Clients get "304 Not Modified" for documents they have already downloaded.
+*/
+
+#include <ESP8266WiFi.h>
+#include <almilukESP8266SSDP.h>
+
+#define NETNAME ""
+#define PASSWORD ""
+
+static const char g_scpd[] PROGMEM =
+"<?xml version=\"1.0\"?>"
+"<scpd xmlns=\"urn:schemas-upnp-org:service-1-0\">"
+"<specVersion><major>1</major><minor>0</minor></specVersion>"
+"<actionList></actionList>"
+"<serviceStateTable></serviceStateTable>"
+"</scpd>\r\n";
+
+// g_scpd compressed with gzip
+static const uint8_t g_scpd_gz[] PROGMEM = {
+	0x1f, 0x8b, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x03, 0x6d, 0x4e, 0xbb, 0x0e, 0xc2, 0x30,
+	0x0c, 0xdc, 0x91, 0xf8, 0x87, 0x2a, 0x7b, 0x68, 0xb2, 0x56, 0x6e, 0xfa, 0x03, 0x6c, 0x20, 0xf6,
+	0x10, 0x2c, 0x08, 0x6a, 0x1e, 0x8a, 0xd3, 0x8a, 0xcf, 0xaf, 0x4b, 0x19, 0x40, 0x62, 0xba, 0x3b,
+	0xdf, 0xf9, 0x6c, 0x18, 0x5e, 0x61, 0x6c, 0x66, 0x2c, 0xe4, 0x53, 0xec, 0x85, 0x3e, 0x28, 0x31,
+	0x18, 0x20, 0x97, 0x6f, 0x0d, 0x1b, 0x91, 0x7a, 0x31, 0x95, 0xd8, 0x91, 0x7b, 0x60, 0xb0, 0x24,
+	0xa7, 0x1c, 0xb3, 0x4c, 0xe5, 0xde, 0x11, 0x96, 0xd9, 0x3b, 0x94, 0x5a, 0x2a, 0xc1, 0xf1, 0x8c,
+	0xee, 0xb2, 0x55, 0x18, 0x08, 0xf6, 0x99, 0x8a, 0xd1, 0xd0, 0x6e, 0x04, 0x82, 0x8f, 0x0c, 0x8a,
+	0xf5, 0x9b, 0x40, 0xfb, 0x93, 0xb6, 0xae, 0x32, 0x1e, 0x3d, 0x55, 0x76, 0xbe, 0xc5, 0xe7, 0xc2,
+	0xa9, 0xda, 0x8a, 0x67, 0x7b, 0x1d, 0x71, 0xdd, 0xfc, 0x37, 0xe3, 0x57, 0xcd, 0x7e, 0xb7, 0x00,
+	0x23, 0x81, 0x53, 0x1b, 0xc8, 0x00, 0x00, 0x00
+};
+
+void setup() {
+	Serial.begin(115200);
+
+	WiFi.mode(WIFI_STA);
+	WiFi.begin(NETNAME, PASSWORD);
+	Serial.print("Waiting for WiFi connection");
+	while (!WiFi.localIP().isSet()) {
+		Serial.print('.');
+		delay(500);
+	}
+	Serial.println("\nConnected to WiFi");
+
+	SSDP.setDeviceType("almiluk-domain", "esp8266-ssdp-test", "1.0");
+	SSDP.setName("myESP");
+	SSDP.setSchemaURL("ssdp/schema.xml");
+
+	SSDPClass::SSDPServiceType services[] = {
+		{"almiluk-domain", "service1", "1"}
+	};
+	SSDP.setServiceTypes(services, 1);
+
+	SSDP.setHTTPServer(true);
+	// It is served at "ssdp/service0.xml", compressed to clients which accept gzip
+	SSDP.setServiceSCPD(0, g_scpd, strlen_P(g_scpd), g_scpd_gz, sizeof(g_scpd_gz));
+
+	if (SSDP.begin())
+		Serial.println("SSDP begun");
+	else
+		Serial.println("SSDP init failed");
+}
+
+void loop() {
+	// Sends scheduled search responses and NOTIFY messages, HTTP requests are served on lwIP callbacks
+	SSDP.loop();
+	delay(16);
+}
@@ -0,0 +1,140 @@
+import gzip
+import socket
+from urllib.parse import urlparse
+
+
+SSDP_ADDR = "239.255.255.250";
+SSDP_PORT = 1900;
+
+device_domain = "almiluk-domain"
+device_type = "esp8266-ssdp-test"
+device_version = "1.0"
+
+schema_path = "/ssdp/schema.xml"
+scpd_path = "/ssdp/service0.xml"
+
+
+def find_device() -> tuple:
+    """Returns (host, port) of the built-in HTTP server from LOCATION of the search response."""
+    mx_val = 3
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM, socket.IPPROTO_UDP)
+    sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_TTL, 5)
+    sock.bind(('', 19001))
+    sock.settimeout(mx_val * 1.1)
+
+    st = f"urn:{device_domain}:device:{device_type}:{device_version}"
+    ssdpRequest = ("M-SEARCH * HTTP/1.1\r\n"
+                + "HOST: %s:%d\r\n" % (SSDP_ADDR, SSDP_PORT)
+                + "MAN: \"ssdp:discover\"\r\n"
+                + "MX: %d\r\n" % (mx_val, )
+                + "ST: %s\r\n" % (st, ) + "\r\n")
+    sock.sendto(ssdpRequest.encode(), (SSDP_ADDR, SSDP_PORT))
+    try:
+        while True:
+            data, addr = sock.recvfrom(10240)
+            for line in data.decode().split("\r\n"):
+                key, _, value = line.partition(":")
+                if key.strip().upper() == "LOCATION":
+                    location = urlparse(value.strip())
+                    return location.hostname, location.port or 80
+    except socket.timeout:
+        raise SystemExit("device not found")
+    finally:
+        sock.close()
+
+
+def read_response(sock) -> tuple:
+    """Reads one response from the socket, returns (status, headers, body)."""
+    data = b""
+    while b"\r\n\r\n" not in data:
+        chunk = sock.recv(1024)
+        if not chunk:
+            raise AssertionError("connection closed before the header")
+        data += chunk
+    head, _, body = data.partition(b"\r\n\r\n")
+    lines = head.decode().split("\r\n")
+    status = int(lines[0].split(" ")[1])
+    headers = {}
+    for line in lines[1:]:
+        key, _, value = line.partition(":")
+        headers[key.strip().lower()] = value.strip()
+
+    length = int(headers.get("content-length", "0"))
+    while len(body) < length:
+        chunk = sock.recv(1024)
+        if not chunk:
+            raise AssertionError("connection closed before the body")
+        body += chunk
+    # Pipelined responses must not be merged
+    assert len(body) == length, "extra data after the body"
+    return status, headers, body
+
+
+def request(path, headers="", keep_alive=False) -> str:
+    return ("GET %s HTTP/1.1\r\n" % (path, )
+            + "Host: device\r\n"
+            + headers
+            + ("" if keep_alive else "Connection: close\r\n") + "\r\n")
+
+
+def get(addr, path, headers="") -> tuple:
+    with socket.create_connection(addr, timeout=5) as sock:
+        sock.sendall(request(path, headers).encode())
+        return read_response(sock)
+
+
+def test_etag(addr):
+    status, headers, body = get(addr, schema_path)
+    assert status == 200, status
+    assert "etag" in headers, headers
+    assert b"<serviceList>" in body and b"service0.xml" in body, body
+    print("200 with ETag:", headers["etag"])
+
+    status, headers, body = get(addr, schema_path, "If-None-Match: %s\r\n" % (headers["etag"], ))
+    assert status == 304, status
+    assert not body
+    print("304 on If-None-Match")
+
+
+def test_keep_alive(addr):
+    with socket.create_connection(addr, timeout=5) as sock:
+        sock.sendall(request(schema_path, keep_alive=True).encode())
+        status, headers, _ = read_response(sock)
+        assert status == 200 and headers.get("connection") == "keep-alive", (status, headers)
+        sock.sendall(request(scpd_path, keep_alive=True).encode())
+        status, _, body = read_response(sock)
+        assert status == 200 and b"<scpd" in body, status
+
+        # Pipelined requests, the second header follows the whole first body
+        sock.sendall((request(schema_path, keep_alive=True) + request(scpd_path, keep_alive=True)).encode())
+        assert read_response(sock)[0] == 200
+        status, _, body = read_response(sock)
+        assert status == 200 and b"<scpd" in body, status
+    print("keep-alive: 4 requests on one connection")
+
+
+def test_gzip(addr):
+    status, headers, plain = get(addr, scpd_path)
+    assert status == 200 and "content-encoding" not in headers, headers
+
+    status, headers, body = get(addr, scpd_path, "Accept-Encoding: gzip, deflate\r\n")
+    assert status == 200, status
+    assert headers.get("content-encoding") == "gzip", headers
+    assert gzip.decompress(body) == plain
+    print("gzip SCPD: %d of %d bytes" % (len(body), len(plain)))
+
+
+def test_not_found(addr):
+    status, _, _ = get(addr, "/ssdp/service1.xml")
+    assert status == 404, status
+    print("404 for unknown document")
+
+
+if __name__ == '__main__':
+    addr = find_device()
+    print("Device found, HTTP server: ", addr)
+    test_etag(addr)
+    test_keep_alive(addr)
+    test_gzip(addr)
+    test_not_found(addr)
+    print("All tests passed")
@@ -0,0 +1,74 @@
+/*
+*  The device works as usual SSDP device and as caching SSDP proxy for clients of its SoftAP.
+*  Their searches are answered from the cache of devices announced in the network it is connected to,
+*  only cache misses are forwarded. NAPT routes SoftAP clients to the found devices, it requires
+*  lwIP variant "v2 Higher Bandwidth" (Tools > lwIP Variant), without it the proxy still answers
+*  searches, but LOCATION of the devices is unreachable from SoftAP.
+*/
+
+#include <ESP8266WebServer.h>
+#include <ESP8266WiFi.h>
+#include <almilukESP8266SSDP.h>
+
+#if LWIP_FEATURES && !LWIP_IPV6
+#include <lwip/napt.h>
+
+#define NAPT_SIZE 1000
+#define NAPT_PORT_SIZE 10
+#endif
+
+#define NETNAME ""
+#define PASSWORD ""
+#define AP_NETNAME "esp-ssdp-proxy"
+#define AP_PASSWORD "12345678"
+
+ESP8266WebServer g_webServer(80);
+
+void setup() {
+	Serial.begin(115200);
+
+	// Both interfaces are required for the proxy
+	WiFi.mode(WIFI_AP_STA);
+	WiFi.softAP(AP_NETNAME, AP_PASSWORD);
+	WiFi.begin(NETNAME, PASSWORD);
+	Serial.print("Waiting for WiFi connection");
+	while (!WiFi.localIP().isSet()) {
+		Serial.print('.');
+		delay(500);
+	}
+	Serial.println("\nConnected to WiFi");
+
+#if LWIP_FEATURES && !LWIP_IPV6
+	// SoftAP clients reach the upstream devices through the station interface
+	if (ip_napt_init(NAPT_SIZE, NAPT_PORT_SIZE) == ERR_OK && ip_napt_enable_no(SOFTAP_IF, 1) == ERR_OK)
+		Serial.println("NAPT enabled");
+	else
+		Serial.println("NAPT init failed");
+#else
+	Serial.println("NAPT is not available, SoftAP clients can't reach upstream devices");
+#endif
+
+	SSDP.setDeviceType("almiluk-domain", "esp8266-ssdp-proxy", "1.0");
+	SSDP.setName("mySSDPProxy");
+	// Must be called before begin()
+	SSDP.setProxy(true);
+
+	if (SSDP.begin())
+		Serial.println("SSDP begun");
+	else
+		Serial.println("SSDP init failed");
+
+	g_webServer.on("/ssdp/schema.xml", []() {
+		SSDP.schema(g_webServer.client());
+		});
+	g_webServer.begin();
+
+	Serial.println("Web server started");
+}
+
+void loop() {
+	SSDP.loop();
+	g_webServer.handleClient();
+
+	delay(16);
+}
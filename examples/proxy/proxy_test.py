@@ -0,0 +1,190 @@
+import argparse
+import select
+import socket
+import struct
+import uuid
+from time import monotonic, sleep
+
+
+SSDP_ADDR = "239.255.255.250";
+SSDP_PORT = 1900;
+
+# SSDP_PROXY_FORWARD_INTERVAL of the library, in seconds
+FORWARD_INTERVAL = 1.0
+
+device_uuid = "uuid:%s" % (uuid.uuid4(), )
+# Types are unique for the run, so other hosts don't search or announce them
+suffix = device_uuid[-8:]
+cached_type = f"urn:almiluk-domain:device:proxy-test-{suffix}:1"
+missed_type = f"urn:almiluk-domain:service:proxy-test-{suffix}:1"
+
+
+def parse(data) -> tuple:
+    """Returns (start line, headers) of the SSDP message."""
+    lines = data.decode(errors="replace").split("\r\n")
+    headers = {}
+    for line in lines[1:]:
+        key, _, value = line.partition(":")
+        headers[key.strip().upper()] = value.strip()
+    return lines[0], headers
+
+
+class FakeDevice:
+    """Device in the upstream network, it announces itself and records searches forwarded by the proxy."""
+
+    def __init__(self, upstream_ip, softap_ip):
+        self.upstream_ip = upstream_ip
+        self.softap_ip = softap_ip
+        self.location = "http://%s:8080/description.xml" % (upstream_ip, )
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM, socket.IPPROTO_UDP)
+        self.sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        self.sock.bind(('', SSDP_PORT))
+        mreq = struct.pack("4s4s", socket.inet_aton(SSDP_ADDR), socket.inet_aton(upstream_ip))
+        self.sock.setsockopt(socket.IPPROTO_IP, socket.IP_ADD_MEMBERSHIP, mreq)
+        self.sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_IF, socket.inet_aton(upstream_ip))
+        self.sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_TTL, 2)
+        # (address, ST) of every M-SEARCH for the test types which came from the proxy
+        self.searches = []
+
+    def notify(self, nt):
+        usn = device_uuid if nt == device_uuid else "%s::%s" % (device_uuid, nt)
+        message = ("NOTIFY * HTTP/1.1\r\n"
+                + "HOST: %s:%d\r\n" % (SSDP_ADDR, SSDP_PORT)
+                + "CACHE-CONTROL: max-age=300\r\n"
+                + "LOCATION: %s\r\n" % (self.location, )
+                + "NT: %s\r\n" % (nt, )
+                + "NTS: ssdp:alive\r\n"
+                + "SERVER: Linux/1.0 UPNP/2.0 proxy_test/1.0\r\n"
+                + "USN: %s\r\n" % (usn, ) + "\r\n")
+        self.sock.sendto(message.encode(), (SSDP_ADDR, SSDP_PORT))
+
+    def respond(self, st, addr):
+        message = ("HTTP/1.1 200 OK\r\n"
+                + "CACHE-CONTROL: max-age=300\r\n"
+                + "EXT:\r\n"
+                + "LOCATION: %s\r\n" % (self.location, )
+                + "SERVER: Linux/1.0 UPNP/2.0 proxy_test/1.0\r\n"
+                + "ST: %s\r\n" % (st, )
+                + "USN: %s::%s\r\n" % (device_uuid, st) + "\r\n")
+        self.sock.sendto(message.encode(), addr)
+
+    def handle(self):
+        data, addr = self.sock.recvfrom(10240)
+        start, headers = parse(data)
+        # Searches of the test itself are seen here too if the interfaces share a network
+        if not start.startswith("M-SEARCH") or addr[0] in (self.upstream_ip, self.softap_ip):
+            return
+        st = headers.get("ST", "")
+        if st in (cached_type, missed_type):
+            print("Forwarded search from %s: %s" % (addr[0], st))
+            self.searches.append((addr, st))
+            if st == missed_type:
+                self.respond(st, addr)
+
+
+class Client:
+    """SoftAP client of the proxy."""
+
+    def __init__(self, softap_ip):
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM, socket.IPPROTO_UDP)
+        self.sock.bind((softap_ip, 0))
+        self.sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_IF, socket.inet_aton(softap_ip))
+        self.sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_TTL, 2)
+        self.responses = []
+
+    def search(self, st, mx):
+        message = ("M-SEARCH * HTTP/1.1\r\n"
+                + "HOST: %s:%d\r\n" % (SSDP_ADDR, SSDP_PORT)
+                + "MAN: \"ssdp:discover\"\r\n"
+                + "MX: %d\r\n" % (mx, )
+                + "ST: %s\r\n" % (st, ) + "\r\n")
+        self.sock.sendto(message.encode(), (SSDP_ADDR, SSDP_PORT))
+
+    def handle(self):
+        data, addr = self.sock.recvfrom(10240)
+        start, headers = parse(data)
+        if start.startswith("HTTP/1.1 200") and headers.get("USN", "").startswith(device_uuid):
+            print("Response from %s: %s" % (addr[0], headers.get("ST")))
+            self.responses.append(headers)
+
+
+def run(device, clients, duration):
+    """Handles datagrams of the device and the clients for the duration (seconds)."""
+    sockets = {device.sock: device}
+    sockets.update((client.sock, client) for client in clients)
+    end = monotonic() + duration
+    while True:
+        left = end - monotonic()
+        if left <= 0:
+            break
+        ready, _, _ = select.select(list(sockets), [], [], left)
+        for sock in ready:
+            sockets[sock].handle()
+
+
+def test_cached(device, softap_ip) -> bool:
+    print("\n\nSearch for an announced device is answered from the cache...\n")
+    for nt in ["upnp:rootdevice", device_uuid, cached_type]:
+        device.notify(nt)
+    run(device, [], 1)
+
+    client = Client(softap_ip)
+    client.search(cached_type, 2)
+    run(device, [client], 2.5)
+
+    answered = any(headers.get("ST") == cached_type and headers.get("LOCATION") == device.location
+        for headers in client.responses)
+    forwarded = [st for _, st in device.searches if st == cached_type]
+    print("Answered: %s, forwarded upstream: %d" % (answered, len(forwarded)))
+    return answered and not forwarded
+
+
+def test_forward_rate_limit(device, softap_ip) -> bool:
+    print("\n\nCache misses are forwarded once per %.1f s, responses are relayed...\n" % (FORWARD_INTERVAL, ))
+    # Requesters differ by port, the proxy relays responses to each of them
+    clients = [Client(softap_ip) for _ in range(3)]
+    for client in clients:
+        client.search(missed_type, 3)
+        sleep(0.1)
+    start = monotonic()
+    run(device, clients, FORWARD_INTERVAL * 0.8)
+    forwarded = [st for _, st in device.searches if st == missed_type]
+    print("Forwarded within %.1f s: %d" % (monotonic() - start, len(forwarded)))
+    run(device, clients, 3)
+
+    relayed = sum(1 for client in clients if any(headers.get("ST") == missed_type for headers in client.responses))
+    print("Requesters with relayed response: %d/%d" % (relayed, len(clients)))
+    return len(forwarded) == 1 and relayed == len(clients)
+
+
+def test_relayed_cached(device, softap_ip) -> bool:
+    print("\n\nRelayed response is cached too...\n")
+    forwarded_before = len(device.searches)
+    client = Client(softap_ip)
+    client.search(missed_type, 2)
+    run(device, [client], 2.5)
+    answered = any(headers.get("ST") == missed_type for headers in client.responses)
+    print("Answered: %s, forwarded upstream: %d" % (answered, len(device.searches) - forwarded_before))
+    return answered and len(device.searches) == forwarded_before
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Tests the SSDP proxy of examples/proxy. "
+        "The host must be connected both to the upstream network and to the SoftAP of the device.")
+    parser.add_argument("--upstream", required=True, help="IP address of the host in the upstream network")
+    parser.add_argument("--softap", required=True, help="IP address of the host in the SoftAP network")
+    args = parser.parse_args()
+
+    device = FakeDevice(args.upstream, args.softap)
+    results = [
+        ("Cached answer", test_cached(device, args.softap)),
+        ("Forward rate limit", test_forward_rate_limit(device, args.softap)),
+        ("Cached relayed response", test_relayed_cached(device, args.softap)),
+    ]
+    print()
+    for name, passed in results:
+        print("%s: %s" % (name, "passed" if passed else "FAILED"))
+
+
+if __name__ == '__main__':
+    main()
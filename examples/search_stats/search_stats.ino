@@ -0,0 +1,48 @@
+/*
+*  The device counts received search requests: most frequent ST values, requesters and User-Agents.
+*  Send 'p' to serial port to print the statistics, send 'r' to reset them (see search_stats_test.py).
+*/
+
+#include <ESP8266WiFi.h>
+#include <almilukESP8266SSDP.h>
+#include <SSDPSearchStats.h>
+
+#define NETNAME ""
+#define PASSWORD ""
+
+void setup() {
+	Serial.begin(115200);
+
+	WiFi.mode(WIFI_STA);
+	WiFi.begin(NETNAME, PASSWORD);
+	Serial.print("Waiting for WiFi connection");
+	while (!WiFi.localIP().isSet()) {
+		Serial.print('.');
+		delay(500);
+	}
+	Serial.println("\nConnected to WiFi");
+
+	SSDP.setDeviceType("almiluk-domain", "esp8266-ssdp-test", "1.0");
+	SSDP.setName("myESP");
+	SSDP.setSchemaURL("ssdp/schema.xml");
+	SSDP.setSearchStats(true);
+
+	if (SSDP.begin())
+		Serial.println("SSDP begun");
+	else
+		Serial.println("SSDP init failed");
+}
+
+void loop() {
+	SSDP.loop();
+
+	if (Serial.available()) {
+		char command = Serial.read();
+		if (command == 'p')
+			Serial.print(*SSDP.getSearchStats());
+		else if (command == 'r')
+			SSDP.getSearchStats()->reset();
+	}
+
+	delay(16);
+}
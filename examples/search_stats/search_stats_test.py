@@ -0,0 +1,113 @@
+import argparse
+import socket
+import uuid
+from time import sleep
+
+
+SSDP_ADDR = "239.255.255.250";
+SSDP_PORT = 1900;
+
+# Types are unique for the run, so searches of other hosts don't mix with them
+suffix = str(uuid.uuid4())[:8]
+# (ST, User-Agent, number of searches), ST values fit to SSDP_STATS_LABEL_SIZE
+searches = [
+    (f"urn:test:service:a-{suffix}:1", "stats-test/1.0 UPnP/2.0", 12),
+    (f"urn:test:service:b-{suffix}:1", "stats-test/1.0 UPnP/2.0", 6),
+    (f"urn:test:service:c-{suffix}:1", "other-test/2.0 UPnP/1.1", 3),
+]
+
+
+def send_searches(host):
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM, socket.IPPROTO_UDP)
+    sock.bind((host, 0))
+    sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_IF, socket.inet_aton(host))
+    sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_TTL, 2)
+    for st, user_agent, num in searches:
+        ssdpRequest = ("M-SEARCH * HTTP/1.1\r\n"
+                    + "HOST: %s:%d\r\n" % (SSDP_ADDR, SSDP_PORT)
+                    + "MAN: \"ssdp:discover\"\r\n"
+                    + "MX: 1\r\n"
+                    + "ST: %s\r\n" % (st, )
+                    + "USER-AGENT: %s\r\n" % (user_agent, ) + "\r\n")
+        for _ in range(num):
+            sock.sendto(ssdpRequest.encode(), (SSDP_ADDR, SSDP_PORT))
+            sleep(0.05)
+    sock.close()
+
+
+def read_stats(port) -> tuple:
+    """Asks the device to print the statistics, returns (searches number, {section: {value: (count, error)}})."""
+    port.reset_input_buffer()
+    port.write(b"p")
+    total = None
+    sections = {}
+    section = None
+    while True:
+        line = port.readline().decode(errors="replace").rstrip("\r\n")
+        if not line:
+            break
+        if line.startswith("SSDP searches:"):
+            total = int(line.partition(":")[2])
+        elif line.endswith(":") and not line.startswith("\t"):
+            section = sections.setdefault(line[:-1], {})
+        elif line.startswith("\t") and section is not None:
+            counts, _, value = line.strip().partition("\t")
+            count, _, error = counts.partition(" ")
+            section[value] = (int(count), int(error.strip("(+)")))
+    if total is None:
+        raise SystemExit("no statistics received")
+    return total, sections
+
+
+def counted(section, value, expected) -> bool:
+    """Count of top-K entry is overestimated by at most its error."""
+    if value not in section:
+        print("%s: not in the top" % (value, ))
+        return False
+    count, error = section[value]
+    print("%s: %d (+%d), sent %d" % (value, count, error, expected))
+    return count - error <= expected <= count
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Tests search statistics of examples/search_stats.")
+    parser.add_argument("--host", required=True, help="IP address of this host in the network of the device")
+    parser.add_argument("port", help="serial port of the device")
+    parser.add_argument("-b", "--baudrate", type=int, default=115200)
+    args = parser.parse_args()
+
+    import serial as pyserial
+
+    with pyserial.Serial(args.port, args.baudrate, timeout=1) as port:
+        port.write(b"r")
+        sleep(0.5)
+        send_searches(args.host)
+        sleep(1)
+        total, sections = read_stats(port)
+
+    sent = sum(num for _, _, num in searches)
+    user_agents = {}
+    for _, user_agent, num in searches:
+        user_agents[user_agent] = user_agents.get(user_agent, 0) + num
+
+    results = [("All searches counted", total >= sent)]
+    print("Searches: %d, sent %d" % (total, sent))
+    for st, _, num in searches:
+        results.append(("ST " + st, counted(sections.get("ST", {}), st, num)))
+    # Other hosts may search too, the host must be among the requesters with all its searches
+    if args.host in sections.get("Requesters", {}):
+        count, _ = sections["Requesters"][args.host]
+        print("%s: %d, sent %d" % (args.host, count, sent))
+        results.append(("Requester", count >= sent))
+    else:
+        results.append(("Requester", False))
+    for user_agent, num in user_agents.items():
+        results.append(("User-Agent " + user_agent, counted(sections.get("User-Agent", {}), user_agent, num)))
+
+    print()
+    for name, passed in results:
+        print("%s: %s" % (name, "passed" if passed else "FAILED"))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,42 @@
+/*
+*  The device records SSDP traffic and parse decisions to in-RAM ring.
+*  Send 'd' to serial port to get the trace in pcap format (extras/ssdp_trace.py serial <port> -o field.pcap),
+*  send 'c' to clear it. Open the file in Wireshark, markers are on UDP port 19000.
+*/
+
+#include <ESP8266WiFi.h>
+#include <almilukESP8266SSDP.h>
+#include <SSDPTrace.h>
+
+#define NETNAME ""
+#define PASSWORD ""
+
+void setup() {
+	Serial.begin(115200);
+
+	WiFi.mode(WIFI_STA);
+	WiFi.begin(NETNAME, PASSWORD);
+	while (!WiFi.localIP().isSet())
+		delay(500);
+
+	SSDP.setDeviceType("almiluk-domain", "esp8266-ssdp-test", "1.0");
+	SSDP.setName("myESP");
+	SSDP.setSchemaURL("ssdp/schema.xml");
+	SSDP.setTrace(true);
+	SSDP.begin();
+}
+
+void loop() {
+	// Trace is written in SSDP.loop(), so it is read between the calls
+	SSDP.loop();
+
+	if (Serial.available()) {
+		char command = Serial.read();
+		if (command == 'd')
+			SSDP.getTrace()->dump(Serial);
+		else if (command == 'c')
+			SSDP.getTrace()->clear();
+	}
+
+	delay(16);
+}
@@ -0,0 +1,215 @@
+"""Response loss at the requester of "ST: ssdp:all" searches.
+
+simulate: model of many devices answering the same search, compares the old
+    scheduling (one random delay of whole seconds, then all N+3 responses
+    back-to-back) with responses spread evenly over the MX window.
+    It also reports searches the devices drop unanswered because they are
+    still answering the searches of other requesters.
+live: sends real searches to the network and counts responses of the devices
+    with this library. With --requesters N, N requesters search at the same
+    time and searches left without any response of a device are reported.
+    Run it with the old and with the new firmware.
+
+    python bench_search_loss.py simulate --devices 20 --services 3 --search-rate 0.5
+    python bench_search_loss.py live --devices 4 --services 3 --requesters 3 --label after
+"""
+
+import argparse
+import random
+import socket
+import time
+
+
+SSDP_ADDR = "239.255.255.250"
+SSDP_PORT = 1900
+MAX_MX = 5
+# Must be the same as SSDP_RESPONSE_SCHEDULES
+RESPONSE_SCHEDULES = 4
+
+
+def burst_schedule(rng, responses_num, mx):
+    # random(0, MX) seconds, then _advertiseAll(RESPONSE)
+    start = rng.randrange(0, mx) if mx > 0 else 0
+    return [float(start)] * responses_num
+
+
+def spread_schedule(rng, responses_num, mx):
+    # i-th response at random moment of i-th part of the window
+    slot = min(mx, MAX_MX) / responses_num
+    return [i * slot + rng.uniform(0, slot) for i in range(responses_num)]
+
+
+def burst_busy_time(rng, mx):
+    # The device ignored searches until the burst is sent
+    return burst_schedule(rng, 1, mx)[0]
+
+
+def spread_busy_time(rng, mx):
+    # Until the last response of the window
+    return min(mx, MAX_MX) * rng.uniform(0.5, 1.0) if mx > 0 else 0.0
+
+
+def dropped_searches(rng, busy_time, schedules, search_rate, duration, mx):
+    """Returns (dropped, total) searches of one device.
+
+    Searches of other requesters arrive at `search_rate` per second, each one keeps
+    one of `schedules` busy for `busy_time` seconds, searches above them are dropped.
+    """
+    busy_until = []
+    dropped = 0
+    total = 0
+    t = rng.expovariate(search_rate)
+    while t < duration:
+        busy_until = [until for until in busy_until if until > t]
+        if len(busy_until) < schedules:
+            busy_until.append(t + busy_time(rng, mx))
+        else:
+            dropped += 1
+        total += 1
+        t += rng.expovariate(search_rate)
+    return dropped, total
+
+
+def requester_loss(send_times, airtime, rcvbuf, read_interval, rng):
+    """Returns number of datagrams dropped by the requester.
+
+    The shared medium transmits one datagram per `airtime` seconds, the requester
+    socket holds `rcvbuf` datagrams and the application drains it every `read_interval`.
+    """
+    arrivals = []
+    medium_free = 0.0
+    for t in sorted(send_times):
+        medium_free = max(t, medium_free) + airtime
+        arrivals.append(medium_free)
+
+    next_read = rng.uniform(0, read_interval)
+    queued = 0
+    lost = 0
+    for t in arrivals:
+        while next_read <= t:
+            queued = 0
+            next_read += read_interval
+        if queued >= rcvbuf:
+            lost += 1
+        else:
+            queued += 1
+    return lost
+
+
+def simulate(args):
+    responses_num = args.services + 3
+    print(f"{args.devices} devices x {responses_num} responses, MX={args.mx}, "
+          f"requester buffer {args.rcvbuf} datagrams read every {args.read_interval * 1000:.0f} ms, "
+          f"airtime {args.airtime * 1000:.2f} ms/datagram, {args.trials} trials\n")
+
+    for name, schedule in (("before (burst)", burst_schedule), ("after (spread)", spread_schedule)):
+        rng = random.Random(args.seed)
+        lost = 0
+        total = 0
+        for _ in range(args.trials):
+            send_times = []
+            for _ in range(args.devices):
+                send_times += schedule(rng, responses_num, args.mx)
+            lost += requester_loss(send_times, args.airtime, args.rcvbuf, args.read_interval, rng)
+            total += len(send_times)
+        print(f"{name}: lost {lost}/{total} ({100.0 * lost / total:.1f}%)")
+
+    print(f"\nsearches of other requesters: {args.search_rate} per second for {args.duration:.0f} s\n")
+    for name, busy_time, schedules in (("before (burst)", burst_busy_time, 1),
+                                       ("spread, 1 schedule", spread_busy_time, 1),
+                                       (f"after (spread, {RESPONSE_SCHEDULES} schedules)", spread_busy_time,
+                                        RESPONSE_SCHEDULES)):
+        rng = random.Random(args.seed)
+        dropped = 0
+        total = 0
+        for _ in range(args.trials):
+            trial_dropped, trial_total = dropped_searches(rng, busy_time, schedules, args.search_rate,
+                                                          args.duration, args.mx)
+            dropped += trial_dropped
+            total += trial_total
+        print(f"{name}: dropped unanswered {dropped}/{total} ({100.0 * dropped / max(total, 1):.1f}%)")
+
+
+def live(args):
+    expected = args.devices * (args.services + 3)
+    sockets = []
+    for _ in range(args.requesters):
+        sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM, socket.IPPROTO_UDP)
+        sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_TTL, 5)
+        sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, args.rcvbuf_bytes)
+        sock.bind(('', 0))
+        sock.setblocking(False)
+        sockets.append(sock)
+
+    lost = 0
+    unanswered = 0
+    request = ("M-SEARCH * HTTP/1.1\r\n"
+               + "HOST: %s:%d\r\n" % (SSDP_ADDR, SSDP_PORT)
+               + "MAN: \"ssdp:discover\"\r\n"
+               + "MX: %d\r\n" % (args.mx, )
+               + "ST: ssdp:all\r\n" + "\r\n")
+    for _ in range(args.trials):
+        # Concurrent searches of different requesters
+        for sock in sockets:
+            sock.sendto(request.encode(), (SSDP_ADDR, SSDP_PORT))
+
+        received = [0] * len(sockets)
+        devices = [set() for _ in sockets]
+        deadline = time.time() + args.mx + 1
+        while time.time() < deadline:
+            # Busy requester: the socket is read only from time to time
+            time.sleep(args.read_interval)
+            for i, sock in enumerate(sockets):
+                try:
+                    while True:
+                        data, addr = sock.recvfrom(10240)
+                        if b"SERVER: Arduino/1.0 UPNP/2.0" in data and b"HTTP/1.1 200 OK" in data:
+                            received[i] += 1
+                            devices[i].add(addr[0])
+                except BlockingIOError:
+                    pass
+        for i in range(len(sockets)):
+            lost += max(0, expected - received[i])
+            unanswered += max(0, args.devices - len(devices[i]))
+        print("received " + ", ".join(f"{n}/{expected}" for n in received))
+
+    for sock in sockets:
+        sock.close()
+    total = expected * args.trials * len(sockets)
+    searches = args.devices * args.trials * len(sockets)
+    print(f"\n{args.label}: lost {lost}/{total} ({100.0 * lost / total:.1f}%), "
+          f"dropped unanswered {unanswered}/{searches} ({100.0 * unanswered / searches:.1f}%)")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = parser.add_subparsers(dest="mode", required=True)
+
+    sim = sub.add_parser("simulate")
+    sim.add_argument("--devices", type=int, default=20)
+    sim.add_argument("--services", type=int, default=3)
+    sim.add_argument("--mx", type=int, default=3)
+    sim.add_argument("--rcvbuf", type=int, default=32, help="requester socket buffer, datagrams")
+    sim.add_argument("--read-interval", type=float, default=0.1, help="seconds")
+    sim.add_argument("--airtime", type=float, default=0.0005, help="seconds per datagram")
+    sim.add_argument("--trials", type=int, default=200)
+    sim.add_argument("--search-rate", type=float, default=0.5, help="searches of other requesters per second")
+    sim.add_argument("--duration", type=float, default=60, help="seconds of searches per trial")
+    sim.add_argument("--seed", type=int, default=1)
+
+    lv = sub.add_parser("live")
+    lv.add_argument("--devices", type=int, required=True, help="devices with this library in the network")
+    lv.add_argument("--services", type=int, default=3)
+    lv.add_argument("--mx", type=int, default=3)
+    lv.add_argument("--rcvbuf-bytes", type=int, default=4096)
+    lv.add_argument("--read-interval", type=float, default=0.1, help="seconds")
+    lv.add_argument("--trials", type=int, default=5)
+    lv.add_argument("--requesters", type=int, default=1, help="concurrent searches per trial")
+    lv.add_argument("--label", default="firmware")
+
+    args = parser.parse_args()
+    simulate(args) if args.mode == "simulate" else live(args)
+
+
+if __name__ == '__main__':
+    main()
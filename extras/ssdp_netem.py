@@ -0,0 +1,440 @@
+"""Time-to-discovery and stale-cache durations of SSDPClass on an impaired network.
+
+Discrete-event model driven by a seeded virtual clock (milliseconds, like millis()).
+The responder follows SSDPClass: _update() on every received datagram and on
+timer ticks every SSDP_TIMER_INTERVAL ms, one datagram is processed per call,
+up to SSDP_RESPONSE_SCHEDULES searches are answered at once (repeated copies of
+a search being answered are ignored, searches received while all schedules are
+in use are dropped), responses are spread over the MX window, N+3 NOTIFY ssdp:alive with max-age=_interval are
+sent every _interval seconds. Every delivery passes the impairment stage
+(loss, duplication, reordering, delay with jitter, like netem), datagrams share
+one medium, and multicast crosses at most TTL-1 routers.
+
+In each trial the device boots at 0, a control point joins later (so it misses
+the boot announcements), optionally sends searches, and the device loses power
+without ssdp:byebye 3 intervals after the join. Reported per scenario:
+    TTD                 time from the join to the first message of the root device
+    undiscovered        trials without discovery before the power loss
+    expired while alive part of the time after discovery when the cache entry of
+                        the alive device was expired
+    stale               how long the cache entry outlives the device
+    datagrams/h         sent by the device
+
+    python ssdp_netem.py scenarios --trials 200
+    python ssdp_netem.py run --interval 300 --ttl 2 --hops 2 --services 3 --searches 1 --loss 0.1
+"""
+
+import argparse
+import heapq
+import itertools
+import math
+import random
+
+
+SSDP_TIMER_INTERVAL = 100
+SSDP_MAX_MX = 5
+# Must be the same as SSDP_RESPONSE_SCHEDULES
+SSDP_RESPONSE_SCHEDULES = 4
+
+
+class VirtualClock:
+    def __init__(self):
+        self.now = 0.0
+        self._events = []
+        self._order = itertools.count()
+
+    def at(self, time, callback, *args):
+        heapq.heappush(self._events, (time, next(self._order), callback, args))
+
+    def run(self, until):
+        while self._events and self._events[0][0] <= until:
+            time, _, callback, args = heapq.heappop(self._events)
+            self.now = time
+            callback(*args)
+        self.now = until
+
+
+class Packet:
+    def __init__(self, kind, target, sender, mx=0, max_age=0):
+        self.kind = kind
+        self.target = target
+        self.sender = sender
+        self.mx = mx
+        self.max_age = max_age
+
+
+class ImpairedNetwork:
+    """Transport of the model: shared medium, TTL scope of multicast and netem-like impairments."""
+
+    def __init__(self, clock, rng, args):
+        self.clock = clock
+        self.rng = rng
+        self.loss = args.loss
+        self.duplicate = args.duplicate
+        self.reorder = args.reorder
+        self.reorder_delay = args.reorder_delay
+        self.delay = args.delay
+        self.jitter = args.jitter
+        self.airtime = args.airtime
+        self.medium_free = 0.0
+        self.hops = {}
+
+    def attach(self, node, hops):
+        self.hops[node] = hops
+
+    def send(self, sender, packet, dst=None, ttl=None):
+        start = max(self.clock.now, self.medium_free)
+        self.medium_free = start + self.airtime
+        if dst is not None:
+            receivers = [dst]
+        else:
+            receivers = [node for node in self.hops
+                         if node is not sender and abs(self.hops[node] - self.hops[sender]) < ttl]
+        for receiver in receivers:
+            self._deliver(self.medium_free, receiver, packet)
+
+    def _deliver(self, time, receiver, packet):
+        if self.rng.random() < self.loss:
+            return
+        copies = 2 if self.rng.random() < self.duplicate else 1
+        for _ in range(copies):
+            latency = self.delay + self.rng.uniform(0, self.jitter)
+            if self.rng.random() < self.reorder:
+                latency += self.reorder_delay
+            self.clock.at(time + latency, receiver.receive, packet)
+
+
+class Schedule:
+    """ResponseSchedule of SSDPClass: responses to one search."""
+
+    def __init__(self, target, requester, start, total, slot, deadline):
+        self.target = target
+        self.requester = requester
+        self.start = start
+        self.total = total
+        self.sent = 0
+        self.slot = slot
+        self.deadline = deadline
+
+
+class Responder:
+    """SSDPClass in autorun mode without proxy and fetcher."""
+
+    def __init__(self, clock, network, rng, interval, ttl, services):
+        self.clock = clock
+        self.network = network
+        self.rng = rng
+        self.interval = interval
+        self.ttl = ttl
+        self.targets = ["upnp:rootdevice", "uuid", "deviceType"] + ["service%d" % i for i in range(services)]
+        self.alive = False
+        self.boot = 0.0
+        self.queue = []
+        self.schedules = []
+        self.notify_time = None
+        self.tick_generation = 0
+        self.sent_datagrams = 0
+
+    def begin(self):
+        self.alive = True
+        self.boot = self.clock.now
+        self._arm()
+
+    def power_off(self):
+        self.alive = False
+        self.tick_generation += 1
+
+    def receive(self, packet):
+        if not self.alive:
+            return
+        self.queue.append(packet)
+        # onRx
+        self._update()
+
+    def _tick(self, generation):
+        if generation == self.tick_generation and self.alive:
+            self._update()
+
+    def _next_tick(self, time, strictly):
+        # Timer ticks are on the grid started at begin()
+        ticks = math.ceil((time - self.boot) / SSDP_TIMER_INTERVAL)
+        tick = self.boot + max(ticks, 1) * SSDP_TIMER_INTERVAL
+        if strictly and tick <= time:
+            tick += SSDP_TIMER_INTERVAL
+        return tick
+
+    def _arm(self):
+        # Only ticks which can do something are simulated
+        self.tick_generation += 1
+        if self.schedules:
+            tick = self._next_tick(min(schedule.start + schedule.deadline for schedule in self.schedules), False)
+        elif self.notify_time is None:
+            tick = self._next_tick(self.clock.now, True)
+        else:
+            tick = self._next_tick(self.notify_time + self.interval * 1000, True)
+        self.clock.at(tick, self._tick, self.tick_generation)
+
+    def _has_free_schedule(self):
+        return len(self.schedules) < SSDP_RESPONSE_SCHEDULES
+
+    def _update(self):
+        if self._has_free_schedule() and self.queue:
+            self._process(self.queue.pop(0))
+
+        if self.schedules:
+            self._send_due()
+        elif self.notify_time is None or self.clock.now - self.notify_time > self.interval * 1000:
+            self.notify_time = self.clock.now
+            for target in self.targets:
+                self._send(Packet("notify", target, self, max_age=self.interval), ttl=self.ttl)
+
+        # All schedules are in use, the rest is flushed
+        if not self._has_free_schedule():
+            self.queue.clear()
+        self._arm()
+
+    def _process(self, packet):
+        if packet.kind != "search":
+            return
+        if packet.target == "ssdp:all":
+            target = "ssdp:all"
+        elif packet.target in self.targets:
+            target = packet.target
+        else:
+            return
+
+        # _findSchedule(): repeated copy of the search
+        if any(schedule.target == target and schedule.requester is packet.sender for schedule in self.schedules):
+            return
+
+        mx = min(packet.mx, SSDP_MAX_MX)
+        total = len(self.targets) if target == "ssdp:all" else 1
+        slot = mx * 1000 // total
+        self.schedules.append(Schedule(target, packet.sender, self.clock.now, total, slot, self._random(slot)))
+
+    def _send_due(self):
+        while True:
+            # The most overdue response first
+            due = [schedule for schedule in self.schedules if self.clock.now - schedule.start >= schedule.deadline]
+            if not due:
+                break
+            schedule = max(due, key=lambda schedule: self.clock.now - schedule.start - schedule.deadline)
+            target = self.targets[schedule.sent] if schedule.target == "ssdp:all" else schedule.target
+            self._send(Packet("response", target, self, max_age=self.interval), dst=schedule.requester)
+            schedule.sent += 1
+            if schedule.sent >= schedule.total:
+                self.schedules.remove(schedule)
+            else:
+                schedule.deadline = schedule.sent * schedule.slot + self._random(schedule.slot)
+
+    def _random(self, limit):
+        # random(0, limit) of Arduino
+        return self.rng.randrange(limit) if limit > 0 else 0
+
+    def _send(self, packet, dst=None, ttl=None):
+        self.sent_datagrams += 1
+        self.network.send(self, packet, dst=dst, ttl=ttl)
+
+
+class ControlPoint:
+    """Caches the root device by its announcements and search responses."""
+
+    def __init__(self, clock, network, searches, search_every, mx, ttl):
+        self.clock = clock
+        self.network = network
+        self.searches = searches
+        self.search_every = search_every
+        self.mx = mx
+        self.ttl = ttl
+        self.joined = None
+        self.discovered = None
+        self.expires = None
+        self.expired_time = 0.0
+
+    def join(self):
+        self.joined = self.clock.now
+        for i in range(self.searches):
+            self.clock.at(self.joined + i * self.search_every * 1000, self._search)
+
+    def _search(self):
+        self.network.send(self, Packet("search", "ssdp:all", self, mx=self.mx), ttl=self.ttl)
+
+    def receive(self, packet):
+        if self.joined is None or packet.kind == "search" or packet.target != "upnp:rootdevice":
+            return
+        now = self.clock.now
+        if self.discovered is None:
+            self.discovered = now
+        elif now > self.expires:
+            self.expired_time += now - self.expires
+        self.expires = max(self.expires or 0, now + packet.max_age * 1000)
+
+
+class Sink:
+    """Other control points, their searches keep the device busy."""
+
+    def receive(self, packet):
+        pass
+
+
+def trial(args, interval, ttl, services, seed):
+    rng = random.Random(seed)
+    clock = VirtualClock()
+    network = ImpairedNetwork(clock, rng, args)
+    device = Responder(clock, network, rng, interval, ttl, services)
+    cp = ControlPoint(clock, network, args.searches, args.search_every, args.mx, args.cp_ttl)
+    sink = Sink()
+    network.attach(device, 0)
+    network.attach(cp, args.hops)
+    network.attach(sink, 0)
+
+    join = rng.uniform(1, interval) * 1000
+    power_off = join + 3 * interval * 1000
+    clock.at(0, device.begin)
+    clock.at(join, cp.join)
+    clock.at(power_off, device.power_off)
+
+    def background_search():
+        # Each one from another requester, so it isn't taken for a repeated copy
+        device.receive(Packet("search", "ssdp:all", Sink(), mx=3))
+        clock.at(clock.now + rng.expovariate(args.background) * 1000, background_search)
+    if args.background > 0:
+        clock.at(rng.expovariate(args.background) * 1000, background_search)
+
+    clock.run(power_off)
+    # Datagrams sent just before the power loss
+    clock.run(power_off + args.delay + args.jitter + args.reorder_delay + 1000)
+
+    result = {"ttd": math.inf, "expired": 0.0, "alive": 0.0, "stale": 0.0,
+              "rate": device.sent_datagrams / (power_off / 3600000.0)}
+    if cp.discovered is not None and cp.discovered < power_off:
+        result["ttd"] = (cp.discovered - join) / 1000
+        result["alive"] = power_off - cp.discovered
+        expired = cp.expired_time
+        if cp.expires < power_off:
+            expired += power_off - cp.expires
+        result["expired"] = expired
+        result["stale"] = max(0.0, cp.expires - power_off) / 1000
+    return result
+
+
+def percentile(values, p):
+    # nearest-rank
+    return values[max(0, math.ceil(p / 100.0 * len(values)) - 1)]
+
+
+def seconds(value):
+    return "-" if math.isinf(value) else "%.1f" % (value, )
+
+
+def summarize(args, interval, ttl, services):
+    results = [trial(args, interval, ttl, services, args.seed * 1000003 + i) for i in range(args.trials)]
+    ttd = sorted(r["ttd"] for r in results)
+    discovered = [r for r in results if not math.isinf(r["ttd"])]
+    alive = sum(r["alive"] for r in discovered)
+    stale = [r["stale"] for r in discovered]
+    return {
+        "ttd": ttd,
+        "p50": percentile(ttd, 50), "p90": percentile(ttd, 90), "p99": percentile(ttd, 99), "max": ttd[-1],
+        "undiscovered": 100.0 * (len(results) - len(discovered)) / len(results),
+        "expired": 100.0 * sum(r["expired"] for r in discovered) / alive if alive else 0.0,
+        "stale_mean": sum(stale) / len(stale) if stale else 0.0,
+        "stale_max": max(stale) if stale else 0.0,
+        "rate": sum(r["rate"] for r in results) / len(results),
+    }
+
+
+HEADER = ("%-34s %8s %8s %8s %8s %7s %8s %8s %8s %8s"
+          % ("scenario", "TTD p50", "p90", "p99", "max", "undisc", "expired", "stale", "stale", "dgram/h"))
+SUBHEADER = "%-34s %8s %8s %8s %8s %7s %8s %8s %8s %8s" % ("", "s", "s", "s", "s", "%", "%", "mean s", "max s", "")
+
+
+def row(name, s):
+    return ("%-34s %8s %8s %8s %8s %7.1f %8.2f %8.1f %8.1f %8.0f"
+            % (name, seconds(s["p50"]), seconds(s["p90"]), seconds(s["p99"]), seconds(s["max"]),
+               s["undiscovered"], s["expired"], s["stale_mean"], s["stale_max"], s["rate"]))
+
+
+def describe(args):
+    return ("loss %.0f%%, duplicate %.0f%%, reorder %.0f%% (+%d ms), delay %d+%d ms, airtime %.2f ms, "
+            "background searches %.3f/s, %d trials, seed %d"
+            % (args.loss * 100, args.duplicate * 100, args.reorder * 100, args.reorder_delay,
+               args.delay, args.jitter, args.airtime, args.background, args.trials, args.seed))
+
+
+def scenarios(args):
+    print(describe(args) + "\n")
+    base = {"interval": 1200, "ttl": 5, "services": 3}
+    groups = [
+        ("_interval, passive control point", "interval", [60, 300, 1200], {"searches": 0}),
+        ("_interval, one search", "interval", [60, 300, 1200], {"searches": 1}),
+        ("TTL, control point 2 hops away, one search", "ttl", [1, 2, 5], {"searches": 1, "hops": 2}),
+        ("services, one search", "services", [0, 3, 8], {"searches": 1}),
+    ]
+    for title, key, values, overrides in groups:
+        print(title)
+        print(HEADER)
+        print(SUBHEADER)
+        scenario_args = argparse.Namespace(**vars(args))
+        for name, value in overrides.items():
+            setattr(scenario_args, name, value)
+        for value in values:
+            settings = dict(base)
+            settings[key] = value
+            name = "interval=%d ttl=%d services=%d" % (settings["interval"], settings["ttl"], settings["services"])
+            print(row(name, summarize(scenario_args, settings["interval"], settings["ttl"], settings["services"])))
+        print()
+
+
+def run(args):
+    print(describe(args) + "\n")
+    s = summarize(args, args.interval, args.ttl, args.services)
+    print(HEADER)
+    print(SUBHEADER)
+    print(row("interval=%d ttl=%d services=%d" % (args.interval, args.ttl, args.services), s))
+
+    ttd = [value for value in s["ttd"] if not math.isinf(value)]
+    if not ttd:
+        return
+    print("\ntime to discovery distribution")
+    bins = 10
+    width = max(ttd[-1] / bins, 0.1)
+    for i in range(bins):
+        low = i * width
+        count = sum(1 for value in ttd if low <= value < low + width or (i == bins - 1 and value >= low))
+        print("%8.1f - %8.1f s %5d %s" % (low, low + width, count, "#" * round(50.0 * count / len(s["ttd"]))))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = parser.add_subparsers(dest="mode", required=True)
+
+    for mode in (sub.add_parser("scenarios"), sub.add_parser("run")):
+        mode.add_argument("--trials", type=int, default=200)
+        mode.add_argument("--seed", type=int, default=1)
+        mode.add_argument("--loss", type=float, default=0.05, help="probability of datagram loss")
+        mode.add_argument("--duplicate", type=float, default=0.01, help="probability of datagram duplication")
+        mode.add_argument("--reorder", type=float, default=0.05, help="probability of extra delay of datagram")
+        mode.add_argument("--reorder-delay", type=int, default=50, help="ms")
+        mode.add_argument("--delay", type=int, default=2, help="ms")
+        mode.add_argument("--jitter", type=int, default=10, help="ms, uniform")
+        mode.add_argument("--airtime", type=float, default=0.5, help="ms per datagram on the shared medium")
+        mode.add_argument("--background", type=float, default=0.02,
+                          help="rate of ssdp:all searches from other control points, 1/s")
+        mode.add_argument("--searches", type=int, default=1, help="searches sent by the control point after join")
+        mode.add_argument("--search-every", type=float, default=5, help="s")
+        mode.add_argument("--mx", type=int, default=3)
+        mode.add_argument("--cp-ttl", type=int, default=4, help="multicast TTL of the control point")
+        mode.add_argument("--hops", type=int, default=0, help="routers between the device and the control point")
+
+    single = sub.choices["run"]
+    single.add_argument("--interval", type=int, default=1200, help="setInterval(), s")
+    single.add_argument("--ttl", type=int, default=5, help="setTTL()")
+    single.add_argument("--services", type=int, default=3)
+
+    args = parser.parse_args()
+    scenarios(args) if args.mode == "scenarios" else run(args)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,222 @@
+"""SSDP traces in the format of SSDPTrace (see src/SSDPTrace.h).
+
+capture: records SSDP datagrams seen by this host to pcap file. Datagrams are
+    truncated and wrapped to synthesized IPv4/UDP headers the same way as on
+    the device (destination is taken from IP_PKTINFO, so unicast datagrams
+    keep their own address), and parse decisions of the device are added as
+    marker records (UDP 127.0.0.1:1900 -> 127.0.0.1:19000), so lab and field
+    traces can be compared side by side. Pass the device attributes to get
+    "accept"/"reject" decisions close to the ones of the device. The markers
+    are an approximation: the host doesn't know when the device sends its last
+    response, so a search is taken as answered at the end of its MX window.
+serial: reads the trace dumped by the device (examples/trace) from serial port,
+    requires pyserial.
+
+    python ssdp_trace.py capture -o lab.pcap --seconds 60 --device-type almiluk-domain:device:esp8266-ssdp-test:1.0
+    python ssdp_trace.py serial /dev/ttyUSB0 -o field.pcap
+"""
+
+import argparse
+import socket
+import struct
+import time
+
+
+SSDP_ADDR = "239.255.255.250"
+SSDP_PORT = 1900
+# Must be the same as in SSDPTrace.h
+SNAP_SIZE = 128
+MARKER_PORT = 19000
+LINKTYPE_RAW = 101
+IP_HEADER_SIZE = 20
+UDP_HEADER_SIZE = 8
+MARKER_ADDR = "127.0.0.1"
+# Must be the same as SSDP_MAX_MX and SSDP_RESPONSE_SCHEDULES
+MAX_MX = 5
+RESPONSE_SCHEDULES = 4
+# Linux value, older Pythons don't export it
+IP_PKTINFO = getattr(socket, "IP_PKTINFO", 8)
+
+
+def checksum(header):
+    total = sum(struct.unpack("!%dH" % (len(header) // 2), header))
+    while total >> 16:
+        total = (total & 0xFFFF) + (total >> 16)
+    return ~total & 0xFFFF
+
+
+class PcapWriter:
+    def __init__(self, stream):
+        self.stream = stream
+        stream.write(struct.pack("<IHHiIII", 0xA1B2C3D4, 2, 4, 0, 0,
+                                 IP_HEADER_SIZE + UDP_HEADER_SIZE + SNAP_SIZE, LINKTYPE_RAW))
+
+    def record(self, timestamp, src, dst, data):
+        udp_len = UDP_HEADER_SIZE + len(data)
+        ip_len = IP_HEADER_SIZE + udp_len
+        ip = bytearray(struct.pack("!BBHHHBBH4s4s", 0x45, 0, ip_len, 0, 0, 1, 17, 0,
+                                   socket.inet_aton(src[0]), socket.inet_aton(dst[0])))
+        ip[10:12] = struct.pack("!H", checksum(bytes(ip)))
+        udp = struct.pack("!HHHH", src[1], dst[1], udp_len, 0)
+        captured = data[:SNAP_SIZE]
+        # Device timestamps have millisecond precision
+        ms = int(timestamp * 1000)
+        self.stream.write(struct.pack("<IIII", ms // 1000, ms % 1000 * 1000,
+                                      IP_HEADER_SIZE + UDP_HEADER_SIZE + len(captured), ip_len))
+        self.stream.write(bytes(ip) + udp + captured)
+
+    def mark(self, timestamp, text):
+        self.record(timestamp, (MARKER_ADDR, SSDP_PORT), (MARKER_ADDR, MARKER_PORT), text.encode()[:SNAP_SIZE - 1])
+
+
+class Device:
+    """Decisions of SSDPClass::_processPacket() for the datagram (approximate, see above)."""
+
+    def __init__(self, args):
+        self.announcements = args.announcements
+        # As stored by the device, without "urn:" and "uuid:"
+        self.device_type = (args.device_type or "").lower()
+        self.uuid = (args.uuid or "").lower()
+        self.services = [service.lower() for service in args.service]
+        self.schedules_num = args.schedules
+        # (until, requester address, target) of the searches being answered
+        self.schedules = []
+
+    def match_target(self, st):
+        """The same checks as SSDPClass::_matchTarget(): the prefix of ST isn't compared."""
+        st = st.lower()
+        if st == "ssdp:all":
+            return "all"
+        if st == "upnp:rootdevice":
+            return "rootdevice"
+        if len(st) > 4 and self.device_type and st[4:] == self.device_type:
+            return "deviceType"
+        if len(st) > 5 and self.uuid and st[5:] == self.uuid:
+            return "uuid"
+        if len(st) > 4 and st[4:] in self.services:
+            return "service %d" % (self.services.index(st[4:]), )
+        return None
+
+    def decide(self, data, addr, now):
+        text = data.decode("utf-8", "replace")
+        lines = text.split("\r\n")
+        request = lines[0].split(" ")
+        method = request[0]
+        if method == "M-SEARCH" or (self.announcements and method in ("NOTIFY", "HTTP/1.1")):
+            pass
+        else:
+            return "reject method"
+        if method != "HTTP/1.1" and (len(request) < 2 or request[1] != "*"):
+            return "reject uri"
+
+        headers = {}
+        for line in lines[1:]:
+            key, sep, value = line.partition(":")
+            if sep:
+                headers[key.strip().upper()] = value.strip()
+
+        if method == "NOTIFY":
+            return "accept notify NT=%s NTS=%s" % (headers.get("NT", ""), headers.get("NTS", ""))
+        if method == "HTTP/1.1":
+            return "accept response ST=%s" % (headers.get("ST", ""), )
+
+        st = headers.get("ST", "")
+        mx = int(headers.get("MX", "0") or 0)
+        target = self.match_target(st)
+        if target is None:
+            return "reject target ST=%s" % (st, )
+
+        self.schedules = [schedule for schedule in self.schedules if schedule[0] > now]
+        if any(schedule[1:] == (addr, target) for schedule in self.schedules):
+            return "reject duplicate ST=%s" % (st, )
+        if len(self.schedules) >= self.schedules_num:
+            return "reject busy ST=%s" % (st, )
+        self.schedules.append((now + min(max(mx, 0), MAX_MX), addr, target))
+        return "accept search ST=%s MX=%u" % (st, mx)
+
+
+def destination(ancdata):
+    """Destination address of the datagram from IP_PKTINFO control message."""
+    for level, kind, data in ancdata:
+        if level == socket.IPPROTO_IP and kind == IP_PKTINFO and len(data) >= 12:
+            # struct in_pktinfo: ifindex, local address, header destination address
+            return socket.inet_ntoa(data[8:12])
+    return SSDP_ADDR
+
+
+def capture(args):
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM, socket.IPPROTO_UDP)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    sock.bind(("", SSDP_PORT))
+    membership = socket.inet_aton(SSDP_ADDR) + socket.inet_aton(args.interface)
+    sock.setsockopt(socket.IPPROTO_IP, socket.IP_ADD_MEMBERSHIP, membership)
+    sock.setsockopt(socket.IPPROTO_IP, IP_PKTINFO, 1)
+    sock.settimeout(0.5)
+
+    device = Device(args)
+    deadline = time.time() + args.seconds
+    records = 0
+    with open(args.output, "wb") as stream:
+        writer = PcapWriter(stream)
+        while time.time() < deadline:
+            try:
+                data, ancdata, _, addr = sock.recvmsg(2048, socket.CMSG_SPACE(12))
+            except socket.timeout:
+                continue
+            now = time.time()
+            writer.record(now, addr, (destination(ancdata), SSDP_PORT), data)
+            writer.mark(now, device.decide(data, addr, now))
+            records += 2
+    sock.close()
+    print("%d records written to %s" % (records, args.output))
+
+
+def serial(args):
+    import serial as pyserial
+
+    with pyserial.Serial(args.port, args.baudrate, timeout=args.idle) as port:
+        port.reset_input_buffer()
+        port.write(b"d")
+        data = bytearray()
+        while True:
+            chunk = port.read(4096)
+            if not chunk:
+                break
+            data += chunk
+
+    magic = struct.pack("<I", 0xA1B2C3D4)
+    start = data.find(magic)
+    if start < 0:
+        raise SystemExit("no trace received")
+    with open(args.output, "wb") as stream:
+        stream.write(data[start:])
+    print("%d bytes written to %s" % (len(data) - start, args.output))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = parser.add_subparsers(dest="mode", required=True)
+
+    cap = sub.add_parser("capture")
+    cap.add_argument("-o", "--output", default="ssdp.pcap")
+    cap.add_argument("--seconds", type=float, default=60)
+    cap.add_argument("--interface", default="0.0.0.0", help="address of the interface to join the group on")
+    cap.add_argument("--device-type", help="as stored by the device: <domain>:device:<type>:<version>")
+    cap.add_argument("--uuid")
+    cap.add_argument("--service", action="append", default=[], help="<domain>:service:<type>:<version>")
+    cap.add_argument("--announcements", action="store_true", help="device has proxy or fetcher enabled")
+    cap.add_argument("--schedules", type=int, default=RESPONSE_SCHEDULES,
+                     help="searches the device answers at once")
+
+    ser = sub.add_parser("serial")
+    ser.add_argument("port")
+    ser.add_argument("-o", "--output", default="ssdp.pcap")
+    ser.add_argument("--baudrate", type=int, default=115200)
+    ser.add_argument("--idle", type=float, default=1.0, help="dump is over after this silence, seconds")
+
+    args = parser.parse_args()
+    capture(args) if args.mode == "capture" else serial(args)
+
+
+if __name__ == '__main__':
+    main()
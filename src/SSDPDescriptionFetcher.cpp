@@ -0,0 +1,483 @@
+#ifndef LWIP_OPEN_SRC
+#define LWIP_OPEN_SRC
+#endif
+
+#include "SSDPDescriptionFetcher.h"
+#include "SSDPHash.h"
+
+#include "lwip/opt.h"
+#include "lwip/tcp.h"
+
+// HTTP/1.0 is used to get not chunked body which ends with the connection
+static const char _ssdp_fetch_request_template[] PROGMEM =
+"GET %s HTTP/1.0\r\n"
+"Host: %.*s\r\n"
+"Connection: close\r\n"
+"\r\n";
+
+SSDPDescriptionFetcher::~SSDPDescriptionFetcher() {
+	for (Slot& slot : _slots)
+		slot.abort();
+}
+
+bool SSDPDescriptionFetcher::fetch(const char* location, int32_t config_id) {
+	uint32_t hash = _ssdp_hash(location, strlen(location));
+
+	if (_isKnown(hash, config_id))
+		return false;
+
+	for (const Slot& slot : _slots)
+		if (slot.state != Slot::IDLE && slot.hash == hash)
+			return false;
+
+	for (uint8_t i = 0; i < _queuedNum; i++) {
+		Request& request = _queue[(_queueHead + i) % SSDP_FETCH_QUEUE_SIZE];
+		if (request.hash == hash) {
+			request.configId = config_id;
+			return false;
+		}
+	}
+
+	if (_queuedNum == SSDP_FETCH_QUEUE_SIZE)
+		return false;
+
+	Request& request = _queue[(_queueHead + _queuedNum) % SSDP_FETCH_QUEUE_SIZE];
+	request.hash = hash;
+	request.configId = config_id;
+	strlcpy(request.location, location, sizeof(request.location));
+	_queuedNum++;
+	return true;
+}
+
+void SSDPDescriptionFetcher::clear() {
+	for (Known& known : _known)
+		known.valid = false;
+}
+
+void SSDPDescriptionFetcher::loop() {
+	unsigned long now = millis();
+
+	for (Slot& slot : _slots) {
+		if ((slot.state == Slot::CONNECTING || slot.state == Slot::RECEIVING)
+			&& now - slot.started > SSDP_FETCH_TIMEOUT) {
+			slot.abort();
+			slot.state = Slot::FAILED;
+		}
+
+		if (slot.state == Slot::DONE) {
+			_remember(slot.hash, slot.description.configId);
+			slot.state = Slot::IDLE;
+			if (_handler)
+				_handler(slot.description);
+		} else if (slot.state == Slot::FAILED) {
+			#ifdef DEBUG_SSDP
+				DEBUG_SSDP.printf("SSDP failed to fetch %s\n", slot.description.location);
+			#endif
+			// Every announcement of the device would start a new request otherwise
+			_remember(slot.hash, slot.description.configId, true);
+			slot.state = Slot::IDLE;
+		}
+
+		while (slot.state == Slot::IDLE && _queuedNum > 0) {
+			const Request& request = _queue[_queueHead];
+			_queueHead = (_queueHead + 1) % SSDP_FETCH_QUEUE_SIZE;
+			_queuedNum--;
+			// Unsupported location (not IPv4 address) is remembered too, so it isn't queued again on every announcement
+			StartResult result = _start(slot, request);
+			if (result != STARTED)
+				_remember(request.hash, request.configId, result == RETRY);
+		}
+	}
+}
+
+uint8_t SSDPDescriptionFetcher::getActiveNum() const {
+	uint8_t num = 0;
+	for (const Slot& slot : _slots)
+		if (slot.state != Slot::IDLE)
+			num++;
+	return num;
+}
+
+SSDPDescriptionFetcher::StartResult SSDPDescriptionFetcher::_start(Slot& slot, const Request& request) {
+	const char* location = request.location;
+	if (strncasecmp(location, "http://", 7))
+		return UNSUPPORTED;
+
+	const char* host = location + 7;
+	const char* path = strchr(host, '/');
+	size_t host_len = path ? (size_t)(path - host) : strlen(host);
+
+	char host_buffer[sizeof("255.255.255.255:65535")];
+	if (host_len >= sizeof(host_buffer))
+		return UNSUPPORTED;
+	memcpy(host_buffer, host, host_len);
+	host_buffer[host_len] = '\0';
+
+	uint16_t port = 80;
+	char* colon = strchr(host_buffer, ':');
+	if (colon) {
+		*colon = '\0';
+		port = atoi(colon + 1);
+	}
+
+	IPAddress addr;
+	if (!addr.fromString(host_buffer))
+		return UNSUPPORTED;
+
+	// Out of memory
+	tcp_pcb* pcb = tcp_new();
+	if (!pcb)
+		return RETRY;
+
+	SSDPDeviceDescription& description = slot.description;
+	strlcpy(description.location, location, sizeof(description.location));
+	description.configId = request.configId;
+	description.deviceType[0] = '\0';
+	description.friendlyName[0] = '\0';
+	description.udn[0] = '\0';
+	description.servicesNum = 0;
+
+	slot.parser.reset(&description);
+	slot.hash = request.hash;
+	slot.pathOffset = host_len + 7;
+	slot.started = millis();
+	slot.pcb = pcb;
+	slot.state = Slot::CONNECTING;
+
+	tcp_arg(pcb, &slot);
+	tcp_err(pcb, reinterpret_cast<tcp_err_fn>(&SSDPDescriptionFetcher::_onErrorStatic));
+	tcp_recv(pcb, reinterpret_cast<tcp_recv_fn>(&SSDPDescriptionFetcher::_onRecvStatic));
+	if (tcp_connect(pcb, addr, port, reinterpret_cast<tcp_connected_fn>(&SSDPDescriptionFetcher::_onConnectedStatic)) != ERR_OK) {
+		slot.abort();
+		slot.state = Slot::IDLE;
+		return RETRY;
+	}
+	return STARTED;
+}
+
+void SSDPDescriptionFetcher::_remember(uint32_t hash, int32_t config_id, bool failed) {
+	Known* slot = nullptr;
+	for (Known& known : _known) {
+		if (known.valid && known.hash == hash) {
+			slot = &known;
+			break;
+		}
+	}
+
+	if (!slot) {
+		slot = &_known[_knownNext];
+		_knownNext = (_knownNext + 1) % SSDP_FETCH_KNOWN_SIZE;
+		slot->valid = true;
+		slot->hash = hash;
+	}
+	slot->configId = config_id;
+	slot->failed = failed;
+	slot->retryAfter = millis() + SSDP_FETCH_RETRY_INTERVAL;
+}
+
+bool SSDPDescriptionFetcher::_isKnown(uint32_t hash, int32_t config_id) const {
+	unsigned long now = millis();
+	for (const Known& known : _known)
+		if (known.valid && known.hash == hash && known.configId == config_id)
+			return !known.failed || (long)(known.retryAfter - now) > 0;
+	return false;
+}
+
+int8_t SSDPDescriptionFetcher::_onConnectedStatic(void* arg, tcp_pcb* pcb, int8_t err) {
+	Slot* slot = static_cast<Slot*>(arg);
+	const char* location = slot->description.location;
+	const char* path = location + slot->pathOffset;
+
+	char request[SSDP_FETCH_REQUEST_SIZE];
+	int len = snprintf_P(request, sizeof(request), _ssdp_fetch_request_template,
+		*path ? path : "/",
+		slot->pathOffset - 7, location + 7
+	);
+
+	if (err != ERR_OK || len <= 0 || len >= (int)sizeof(request)
+		|| tcp_write(pcb, request, len, TCP_WRITE_FLAG_COPY) != ERR_OK) {
+		slot->abort();
+		slot->state = Slot::FAILED;
+		return ERR_ABRT;
+	}
+
+	tcp_output(pcb);
+	slot->state = Slot::RECEIVING;
+	return ERR_OK;
+}
+
+int8_t SSDPDescriptionFetcher::_onRecvStatic(void* arg, tcp_pcb* pcb, pbuf* p, int8_t err) {
+	Slot* slot = static_cast<Slot*>(arg);
+
+	if (!p) {
+		// Connection is closed by the server, so the document is over
+		slot->state = slot->parser.isBody() ? Slot::DONE : Slot::FAILED;
+		return slot->close() ? ERR_ABRT : ERR_OK;
+	}
+
+	char chunk[SSDP_FETCH_CHUNK_SIZE];
+	bool ok = true;
+	uint16_t offset = 0;
+	while (ok && offset < p->tot_len && !slot->parser.isComplete()) {
+		uint16_t len = pbuf_copy_partial(p, chunk, sizeof(chunk), offset);
+		ok = slot->parser.feed(chunk, len);
+		offset += len;
+	}
+	tcp_recved(pcb, p->tot_len);
+	pbuf_free(p);
+
+	if (!ok) {
+		slot->abort();
+		slot->state = Slot::FAILED;
+		return ERR_ABRT;
+	}
+
+	// Nothing interesting after the root device, don't wait for the rest of the document
+	if (slot->parser.isComplete()) {
+		slot->state = Slot::DONE;
+		return slot->close() ? ERR_ABRT : ERR_OK;
+	}
+	return ERR_OK;
+}
+
+void SSDPDescriptionFetcher::_onErrorStatic(void* arg, int8_t err) {
+	// pcb is already freed
+	Slot* slot = static_cast<Slot*>(arg);
+	slot->pcb = nullptr;
+	slot->state = Slot::FAILED;
+}
+
+bool SSDPDescriptionFetcher::Slot::close() {
+	if (!pcb)
+		return false;
+
+	tcp_arg(pcb, nullptr);
+	tcp_err(pcb, nullptr);
+	tcp_recv(pcb, nullptr);
+	bool aborted = false;
+	if (tcp_close(pcb) != ERR_OK) {
+		tcp_abort(pcb);
+		aborted = true;
+	}
+	pcb = nullptr;
+	return aborted;
+}
+
+void SSDPDescriptionFetcher::Slot::abort() {
+	if (!pcb)
+		return;
+
+	tcp_arg(pcb, nullptr);
+	tcp_err(pcb, nullptr);
+	tcp_recv(pcb, nullptr);
+	tcp_abort(pcb);
+	pcb = nullptr;
+}
+
+void SSDPDescriptionFetcher::Parser::reset(SSDPDeviceDescription* description) {
+	_description = description;
+	_http = STATUS;
+	_xml = TEXT;
+	_cr = 0;
+	_spaces = 0;
+	_status = 0;
+	_closing = false;
+	_complete = false;
+	_prev = 0;
+	_nameLen = 0;
+	_depth = 0;
+	_value = nullptr;
+	_valueLen = 0;
+}
+
+bool SSDPDescriptionFetcher::Parser::feed(const char* chunk, size_t len) {
+	for (size_t i = 0; i < len && !_complete; i++) {
+		if (_http == BODY)
+			_feedXml(chunk[i]);
+		else if (!_feedHttp(chunk[i]))
+			return false;
+	}
+	return true;
+}
+
+bool SSDPDescriptionFetcher::Parser::_feedHttp(char c) {
+	(c == '\r' || c == '\n') ? _cr++ : _cr = 0;
+
+	switch (_http) {
+	case STATUS:
+		// "HTTP/1.1 200 OK", status code is between the first and the second spaces
+		if (_cr == 2) {
+			if (_status != 200)
+				return false;
+			_http = HEADERS;
+		} else if (c == ' ') {
+			_spaces++;
+		} else if (_spaces == 1 && c >= '0' && c <= '9') {
+			_status = _status * 10 + (c - '0');
+		}
+		break;
+	case HEADERS:
+		if (_cr == 4)
+			_http = BODY;
+		break;
+	case BODY:
+		break;
+	}
+	return true;
+}
+
+void SSDPDescriptionFetcher::Parser::_feedXml(char c) {
+	switch (_xml) {
+	case TEXT:
+		if (c == '<') {
+			_xml = TAG;
+		} else if (_value && _valueLen < _valueSize - 1 && (_valueLen > 0 || !isspace(c))) {
+			_value[_valueLen++] = c;
+			_value[_valueLen] = '\0';
+		}
+		break;
+	case TAG:
+		_nameLen = 0;
+		_name[0] = '\0';
+		_closing = (c == '/');
+		if (c == '?' || c == '!') {
+			// declaration, comment or CDATA
+			_xml = SKIP;
+			break;
+		}
+		_xml = NAME;
+		if (_closing)
+			break;
+		// fall through
+	case NAME:
+		if (c == '>') {
+			_closing ? _closeElement() : _openElement();
+			_xml = TEXT;
+		} else if (c == '/' || isspace(c)) {
+			_xml = ATTRS;
+		} else if (c == ':') {
+			// namespace prefix
+			_nameLen = 0;
+		} else if (_nameLen < SSDP_FETCH_TAG_SIZE - 1) {
+			_name[_nameLen++] = c;
+			_name[_nameLen] = '\0';
+		}
+		break;
+	case ATTRS:
+		if (c == '>') {
+			if (_closing) {
+				_closeElement();
+			} else {
+				_openElement();
+				if (_prev == '/')
+					_closeElement();
+			}
+			_xml = TEXT;
+		}
+		break;
+	case SKIP:
+		if (c == '>')
+			_xml = TEXT;
+		break;
+	}
+	_prev = c;
+}
+
+void SSDPDescriptionFetcher::Parser::_openElement() {
+	Element parent = (_depth > 0 && _depth <= sizeof(_path)) ? _path[_depth - 1] : OTHER;
+	Element element = OTHER;
+
+	if (_depth == 0 && !strcmp(_name, "root"))
+		element = ROOT;
+	else if (parent == ROOT && !strcmp(_name, "device"))
+		element = DEVICE;
+	else if (parent == DEVICE && !strcmp(_name, "deviceType"))
+		element = DEVICE_TYPE;
+	else if (parent == DEVICE && !strcmp(_name, "friendlyName"))
+		element = FRIENDLY_NAME;
+	else if (parent == DEVICE && !strcmp(_name, "UDN"))
+		element = UDN;
+	else if (parent == DEVICE && !strcmp(_name, "serviceList"))
+		element = SERVICE_LIST;
+	else if (parent == SERVICE_LIST && !strcmp(_name, "service"))
+		element = SERVICE;
+	else if (parent == SERVICE && !strcmp(_name, "serviceType"))
+		element = SERVICE_TYPE;
+
+	if (_depth < sizeof(_path))
+		_path[_depth] = element;
+	_depth++;
+
+	_value = nullptr;
+	_valueLen = 0;
+	switch (element) {
+	case DEVICE_TYPE:
+		_value = _description->deviceType;
+		_valueSize = sizeof(_description->deviceType);
+		break;
+	case FRIENDLY_NAME:
+		_value = _description->friendlyName;
+		_valueSize = sizeof(_description->friendlyName);
+		break;
+	case UDN:
+		_value = _description->udn;
+		_valueSize = sizeof(_description->udn);
+		break;
+	case SERVICE_TYPE:
+		if (_description->servicesNum < SSDP_FETCH_MAX_SERVICES) {
+			_value = _description->serviceTypes[_description->servicesNum];
+			_valueSize = sizeof(_description->serviceTypes[0]);
+		}
+		break;
+	default:
+		break;
+	}
+	if (_value)
+		_value[0] = '\0';
+}
+
+void SSDPDescriptionFetcher::Parser::_closeElement() {
+	if (_depth == 0)
+		return;
+
+	_depth--;
+	Element element = (_depth < sizeof(_path)) ? _path[_depth] : OTHER;
+
+	if (_value) {
+		while (_valueLen > 0 && isspace(_value[_valueLen - 1]))
+			_value[--_valueLen] = '\0';
+		_valueLen = _decodeEntities(_value);
+		if (element == SERVICE_TYPE && _valueLen > 0)
+			_description->servicesNum++;
+	}
+	_value = nullptr;
+
+	if (element == DEVICE)
+		_complete = true;
+}
+
+uint16_t SSDPDescriptionFetcher::Parser::_decodeEntities(char* value) {
+	static const char* const entities[][2] = {
+		{ "&amp;", "&" }, { "&lt;", "<" }, { "&gt;", ">" }, { "&quot;", "\"" }, { "&apos;", "'" }
+	};
+
+	char* out = value;
+	for (const char* in = value; *in; ) {
+		bool decoded = false;
+		if (*in == '&') {
+			for (const auto& entity : entities) {
+				size_t len = strlen(entity[0]);
+				if (!strncmp(in, entity[0], len)) {
+					*out++ = entity[1][0];
+					in += len;
+					decoded = true;
+					break;
+				}
+			}
+		}
+		if (!decoded)
+			*out++ = *in++;
+	}
+	*out = '\0';
+	return out - value;
+}
@@ -0,0 +1,151 @@
+#ifndef ALMILUK_SSDP_DESCRIPTION_FETCHER_H
+#define ALMILUK_SSDP_DESCRIPTION_FETCHER_H
+
+#include "SSDPPacket.h"
+
+struct tcp_pcb;
+struct pbuf;
+
+// Maximal number of simultaneous HTTP requests
+#define SSDP_FETCH_CONCURRENCY		2
+#define SSDP_FETCH_QUEUE_SIZE		8
+// Number of remembered description locations with their CONFIGID
+#define SSDP_FETCH_KNOWN_SIZE		16
+// Received data is fed to the parser by chunks of this size
+#define SSDP_FETCH_CHUNK_SIZE		128
+#define SSDP_FETCH_TIMEOUT			5000
+// Location which failed to be fetched is skipped for this time (ms)
+#define SSDP_FETCH_RETRY_INTERVAL	30000
+#define SSDP_FETCH_MAX_SERVICES		4
+#define SSDP_FETCH_TAG_SIZE			16
+#define SSDP_FETCH_REQUEST_SIZE		256
+
+// Fields of a device description document (root device only). Values that don't fit to the buffers are truncated.
+struct SSDPDeviceDescription {
+	char location[SSDP_LOCATION_SIZE];
+	int32_t configId;
+	char deviceType[SSDP_DEVICE_TYPE_SIZE + 4];
+	char friendlyName[SSDP_FRIENDLY_NAME_SIZE];
+	char udn[SSDP_UUID_SIZE + 5];
+	uint8_t servicesNum;
+	char serviceTypes[SSDP_FETCH_MAX_SERVICES][SSDP_ST_VAL_SIZE];
+};
+
+/* Fetches device description documents (LOCATION of announcements) for control point.
+* At most SSDP_FETCH_CONCURRENCY requests run at once, the rest are queued. Responses are parsed
+* on the fly by fixed-size chunks, so the whole document is never stored in memory.
+* A location is not fetched again while its announced CONFIGID stays the same,
+* and not earlier than in SSDP_FETCH_RETRY_INTERVAL ms after a failed attempt.
+* Only IPv4 addresses are supported in locations (no DNS lookup).
+*
+* Pass the fetcher to SSDPClass::setFetcher() to feed it with received announcements,
+* or call fetch() yourself. You must call loop() regularly, handler is called from it.
+*/
+class SSDPDescriptionFetcher {
+public:
+	typedef std::function<void(const SSDPDeviceDescription& description)> DescriptionHandler;
+
+	~SSDPDescriptionFetcher();
+
+	void onDescription(DescriptionHandler handler) { _handler = handler; }
+	// Returns false if the location is skipped (known, already queued or the queue is full)
+	bool fetch(const char* location, int32_t config_id = -1);
+	// Forget all known locations, so they will be fetched again
+	void clear();
+	void loop();
+
+	uint8_t getActiveNum() const;
+	uint8_t getQueuedNum() const { return _queuedNum; }
+
+private:
+	struct Request {
+		uint32_t hash;
+		int32_t configId;
+		char location[SSDP_LOCATION_SIZE];
+	};
+
+	struct Known {
+		bool valid = false;
+		// The last attempt failed, the location is known only until retryAfter
+		bool failed = false;
+		uint32_t hash = 0;
+		int32_t configId = -1;
+		unsigned long retryAfter = 0;
+	};
+
+	// Streaming extractor of description fields from HTTP response
+	class Parser {
+	public:
+		void reset(SSDPDeviceDescription* description);
+		// Returns false if response is not a successful HTTP response
+		bool feed(const char* chunk, size_t len);
+		bool isComplete() const { return _complete; }
+		bool isBody() const { return _http == BODY; }
+
+	private:
+		enum HttpState : uint8_t { STATUS, HEADERS, BODY };
+		enum XmlState : uint8_t { TEXT, TAG, NAME, ATTRS, SKIP };
+		enum Element : uint8_t { OTHER, ROOT, DEVICE, DEVICE_TYPE, FRIENDLY_NAME, UDN, SERVICE_LIST, SERVICE, SERVICE_TYPE };
+
+		bool _feedHttp(char c);
+		void _feedXml(char c);
+		void _openElement();
+		void _closeElement();
+		// Decodes predefined XML entities in place, returns new length
+		static uint16_t _decodeEntities(char* value);
+
+		SSDPDeviceDescription* _description = nullptr;
+		HttpState _http = STATUS;
+		XmlState _xml = TEXT;
+		uint8_t _cr = 0;
+		uint8_t _spaces = 0;
+		int _status = 0;
+		bool _closing = false;
+		bool _complete = false;
+		char _prev = 0;
+		char _name[SSDP_FETCH_TAG_SIZE];
+		uint8_t _nameLen = 0;
+		uint8_t _depth = 0;
+		Element _path[5];
+		char* _value = nullptr;
+		uint16_t _valueSize = 0;
+		uint16_t _valueLen = 0;
+	};
+
+	struct Slot {
+		enum State : uint8_t { IDLE, CONNECTING, RECEIVING, DONE, FAILED };
+
+		State state = IDLE;
+		tcp_pcb* pcb = nullptr;
+		unsigned long started = 0;
+		uint32_t hash = 0;
+		uint16_t pathOffset = 0;
+		Parser parser;
+		SSDPDeviceDescription description;
+
+		// Returns true if connection had to be aborted
+		bool close();
+		void abort();
+	};
+
+	enum StartResult : uint8_t { STARTED, UNSUPPORTED, RETRY };
+
+	// UNSUPPORTED if the location can't be fetched at all, RETRY if it may succeed later
+	StartResult _start(Slot& slot, const Request& request);
+	void _remember(uint32_t hash, int32_t config_id, bool failed = false);
+	bool _isKnown(uint32_t hash, int32_t config_id) const;
+
+	static int8_t _onConnectedStatic(void* arg, tcp_pcb* pcb, int8_t err);
+	static int8_t _onRecvStatic(void* arg, tcp_pcb* pcb, pbuf* p, int8_t err);
+	static void _onErrorStatic(void* arg, int8_t err);
+
+	DescriptionHandler _handler = nullptr;
+	Slot _slots[SSDP_FETCH_CONCURRENCY];
+	Request _queue[SSDP_FETCH_QUEUE_SIZE];
+	uint8_t _queueHead = 0;
+	uint8_t _queuedNum = 0;
+	Known _known[SSDP_FETCH_KNOWN_SIZE];
+	uint8_t _knownNext = 0;
+};
+
+#endif
@@ -0,0 +1,510 @@
+#ifndef LWIP_OPEN_SRC
+#define LWIP_OPEN_SRC
+#endif
+
+#include "SSDPHTTPServer.h"
+#include "SSDPHash.h"
+
+#include "lwip/opt.h"
+#include "lwip/tcp.h"
+
+static const char _ssdp_http_ok_template[] PROGMEM =
+"HTTP/1.1 200 OK\r\n"
+"Content-Type: text/xml; charset=\"utf-8\"\r\n"
+"Content-Length: %u\r\n"
+"ETag: %s\r\n"
+"%s" // Content-Encoding and Vary headers
+"Connection: %s\r\n"
+"Access-Control-Allow-Origin: *\r\n"
+"\r\n";
+
+static const char _ssdp_http_not_modified_template[] PROGMEM =
+"HTTP/1.1 304 Not Modified\r\n"
+"ETag: %s\r\n"
+"Connection: %s\r\n"
+"\r\n";
+
+static const char _ssdp_http_error_template[] PROGMEM =
+"HTTP/1.1 %d %s\r\n"
+"Content-Length: 0\r\n"
+"Connection: %s\r\n"
+"\r\n";
+
+// Writes to fixed buffer, counts length even if buffer is too small (or absent)
+class SSDPBufferPrint : public Print {
+public:
+	SSDPBufferPrint(char* buffer, size_t size) : _buffer(buffer), _size(size) {}
+
+	size_t write(uint8_t c) override {
+		if (_buffer && _length < _size)
+			_buffer[_length] = c;
+		_length++;
+		return 1;
+	}
+
+	size_t length() const { return _length; }
+
+private:
+	char* _buffer;
+	size_t _size;
+	size_t _length = 0;
+};
+
+SSDPHTTPServer::~SSDPHTTPServer() {
+	end();
+}
+
+bool SSDPHTTPServer::begin(uint16_t port) {
+	end();
+
+	tcp_pcb* pcb = tcp_new();
+	if (!pcb)
+		return false;
+
+	if (tcp_bind(pcb, IP_ADDR_ANY, port) != ERR_OK) {
+		tcp_close(pcb);
+		return false;
+	}
+
+	_listener = tcp_listen(pcb);
+	if (!_listener) {
+		tcp_close(pcb);
+		return false;
+	}
+
+	tcp_arg(_listener, this);
+	tcp_accept(_listener, reinterpret_cast<tcp_accept_fn>(&SSDPHTTPServer::_onAcceptStatic));
+
+	// Render it now to not do it in lwIP callback of the first request
+	_renderSchema();
+	return true;
+}
+
+void SSDPHTTPServer::end() {
+	for (Connection& conn : _connections)
+		conn.abort();
+
+	if (_listener) {
+		tcp_arg(_listener, nullptr);
+		tcp_accept(_listener, nullptr);
+		tcp_close(_listener);
+		_listener = nullptr;
+	}
+
+	free(_schemaBody);
+	_schemaBody = nullptr;
+	_schemaValid = false;
+}
+
+bool SSDPHTTPServer::addDocument(const char* url, const char* body, size_t len, const uint8_t* gzip_body, size_t gzip_len) {
+	Document* document = _findDocument(url);
+	if (!document) {
+		if (_documentsNum == SSDP_HTTP_DOCUMENTS)
+			return false;
+		document = &_documents[_documentsNum++];
+		strlcpy(document->url, url, sizeof(document->url));
+	}
+
+	document->body = body;
+	document->len = len;
+	document->gzipBody = gzip_body;
+	document->gzipLen = gzip_body ? gzip_len : 0;
+	document->etag = _ssdp_hash(body, len);
+	return true;
+}
+
+bool SSDPHTTPServer::hasDocument(const char* url) const {
+	for (uint8_t i = 0; i < _documentsNum; i++)
+		if (!strcmp(_documents[i].url, url))
+			return true;
+	return false;
+}
+
+SSDPHTTPServer::Document* SSDPHTTPServer::_findDocument(const char* url) {
+	for (uint8_t i = 0; i < _documentsNum; i++)
+		if (!strcmp(_documents[i].url, url))
+			return &_documents[i];
+	return nullptr;
+}
+
+const SSDPHTTPServer::Document* SSDPHTTPServer::_schema() {
+	// URLBase contains IP address, so the schema is changed with it
+	bool actual = _schemaValid && _schemaBody && _schemaAddr == (uint32_t)WiFi.localIP();
+	// Body which is being sent can't be freed
+	if (!actual && !_isSchemaSending())
+		_renderSchema();
+	return _schemaBody ? &_schemaDocument : nullptr;
+}
+
+bool SSDPHTTPServer::_renderSchema() {
+	SSDPBufferPrint counter(nullptr, 0);
+	_renderer(counter);
+
+	size_t len = counter.length();
+	char* body = (char*)malloc(len + 1);
+	if (!body)
+		return false;
+
+	SSDPBufferPrint print(body, len);
+	_renderer(print);
+	body[len] = '\0';
+
+	free(_schemaBody);
+	_schemaBody = body;
+	_schemaDocument.body = body;
+	_schemaDocument.len = len;
+	_schemaDocument.gzipBody = nullptr;
+	_schemaDocument.gzipLen = 0;
+	_schemaDocument.etag = _ssdp_hash(body, len);
+	_schemaAddr = WiFi.localIP();
+	_schemaValid = true;
+	return true;
+}
+
+bool SSDPHTTPServer::_isSchemaSending() const {
+	for (const Connection& conn : _connections)
+		if (conn.pcb && conn.body && conn.body == _schemaBody)
+			return true;
+	return false;
+}
+
+void SSDPHTTPServer::_process(Connection& conn) {
+	while (conn.pending && conn.state != Connection::SENDING) {
+		pbuf* p = conn.pending;
+		if (conn.pendingOffset >= p->tot_len) {
+			tcp_recved(conn.pcb, p->tot_len);
+			pbuf_free(p);
+			conn.pending = nullptr;
+			break;
+		}
+
+		if (conn.feed(pbuf_get_at(p, conn.pendingOffset++)))
+			_respond(conn);
+	}
+}
+
+void SSDPHTTPServer::_respond(Connection& conn) {
+	conn.state = Connection::SENDING;
+	const char* connection = conn.keepAlive ? "keep-alive" : "close";
+	char* header = conn.responseHeader;
+	size_t size = sizeof(conn.responseHeader);
+	int len;
+
+	const Document* document = nullptr;
+	if (conn.supported)
+		document = strcmp(conn.uri, _schemaURL) ? _findDocument(conn.uri) : _schema();
+
+	if (!conn.supported) {
+		len = snprintf_P(header, size, _ssdp_http_error_template, 501, "Not Implemented", connection);
+	} else if (!document) {
+		len = snprintf_P(header, size, _ssdp_http_error_template, 404, "Not Found", connection);
+	} else {
+		bool gzip = conn.acceptsGzip && document->gzipBody;
+		char etag[SSDP_HTTP_ETAG_SIZE];
+		snprintf(etag, sizeof(etag), "\"%08x%s\"", (unsigned int)document->etag, gzip ? "-gz" : "");
+
+		if (!strcmp(conn.ifNoneMatch, "*") || strstr(conn.ifNoneMatch, etag)) {
+			len = snprintf_P(header, size, _ssdp_http_not_modified_template, etag, connection);
+		} else {
+			const char* encoding = "";
+			if (gzip)
+				encoding = "Content-Encoding: gzip\r\nVary: Accept-Encoding\r\n";
+			else if (document->gzipBody)
+				encoding = "Vary: Accept-Encoding\r\n";
+
+			size_t body_len = gzip ? document->gzipLen : document->len;
+			len = snprintf_P(header, size, _ssdp_http_ok_template, (unsigned int)body_len, etag, encoding, connection);
+			if (!conn.head) {
+				conn.body = gzip ? (const char*)document->gzipBody : document->body;
+				conn.len = body_len;
+				conn.sent = 0;
+			}
+		}
+	}
+
+	if (len <= 0 || len >= (int)size) {
+		conn.abort();
+		return;
+	}
+	conn.headerLen = len;
+	conn.headerSent = 0;
+	_sendResponse(conn);
+}
+
+void SSDPHTTPServer::_sendResponse(Connection& conn) {
+	// Body of the previous pipelined response may fill the send buffer, the header waits for the sent callback then
+	while (conn.headerSent < conn.headerLen) {
+		size_t size = conn.headerLen - conn.headerSent;
+		if (size > tcp_sndbuf(conn.pcb))
+			size = tcp_sndbuf(conn.pcb);
+		if (size == 0 || tcp_write(conn.pcb, conn.responseHeader + conn.headerSent, size, TCP_WRITE_FLAG_COPY) != ERR_OK)
+			break;
+		conn.headerSent += size;
+	}
+
+	char chunk[SSDP_HTTP_CHUNK_SIZE];
+	while (conn.headerSent == conn.headerLen && conn.sent < conn.len) {
+		size_t size = conn.len - conn.sent;
+		if (size > sizeof(chunk))
+			size = sizeof(chunk);
+		if (size > tcp_sndbuf(conn.pcb))
+			size = tcp_sndbuf(conn.pcb);
+		if (size == 0)
+			break;
+
+		// Body may be in PROGMEM
+		memcpy_P(chunk, conn.body + conn.sent, size);
+		if (tcp_write(conn.pcb, chunk, size, TCP_WRITE_FLAG_COPY) != ERR_OK)
+			break;
+		conn.sent += size;
+	}
+	tcp_output(conn.pcb);
+	conn.lastActivity = millis();
+
+	// The rest is sent from sent or poll callbacks
+	if (conn.headerSent < conn.headerLen || conn.sent < conn.len)
+		return;
+
+	if (conn.keepAlive)
+		conn.reset();
+	else
+		conn.close();
+}
+
+int8_t SSDPHTTPServer::_onAcceptStatic(void* arg, tcp_pcb* pcb, int8_t err) {
+	SSDPHTTPServer* self = static_cast<SSDPHTTPServer*>(arg);
+	if (err != ERR_OK || !pcb)
+		return ERR_VAL;
+
+	for (Connection& conn : self->_connections) {
+		if (conn.pcb)
+			continue;
+
+		conn.server = self;
+		conn.pcb = pcb;
+		conn.pending = nullptr;
+		conn.aborted = false;
+		conn.lastActivity = millis();
+		conn.reset();
+
+		tcp_arg(pcb, &conn);
+		tcp_recv(pcb, reinterpret_cast<tcp_recv_fn>(&SSDPHTTPServer::_onRecvStatic));
+		tcp_sent(pcb, reinterpret_cast<tcp_sent_fn>(&SSDPHTTPServer::_onSentStatic));
+		tcp_err(pcb, reinterpret_cast<tcp_err_fn>(&SSDPHTTPServer::_onErrorStatic));
+		tcp_poll(pcb, reinterpret_cast<tcp_poll_fn>(&SSDPHTTPServer::_onPollStatic), 2);
+		tcp_nagle_disable(pcb);
+		return ERR_OK;
+	}
+
+	// The pool is full
+	tcp_abort(pcb);
+	return ERR_ABRT;
+}
+
+int8_t SSDPHTTPServer::_onRecvStatic(void* arg, tcp_pcb* pcb, pbuf* p, int8_t err) {
+	Connection* conn = static_cast<Connection*>(arg);
+
+	if (!p) {
+		conn->close();
+		return conn->aborted ? ERR_ABRT : ERR_OK;
+	}
+
+	// Previous data isn't parsed yet, lwIP will pass this one again later
+	if (conn->pending)
+		return ERR_MEM;
+
+	conn->pending = p;
+	conn->pendingOffset = 0;
+	conn->lastActivity = millis();
+	conn->server->_process(*conn);
+	return conn->aborted ? ERR_ABRT : ERR_OK;
+}
+
+int8_t SSDPHTTPServer::_onSentStatic(void* arg, tcp_pcb* pcb, uint16_t len) {
+	Connection* conn = static_cast<Connection*>(arg);
+
+	if (conn->state == Connection::SENDING) {
+		conn->server->_sendResponse(*conn);
+		if (conn->pcb)
+			conn->server->_process(*conn);
+	}
+	return conn->aborted ? ERR_ABRT : ERR_OK;
+}
+
+int8_t SSDPHTTPServer::_onPollStatic(void* arg, tcp_pcb* pcb) {
+	Connection* conn = static_cast<Connection*>(arg);
+
+	if (millis() - conn->lastActivity > SSDP_HTTP_TIMEOUT) {
+		conn->close();
+	} else if (conn->state == Connection::SENDING) {
+		conn->server->_sendResponse(*conn);
+		if (conn->pcb)
+			conn->server->_process(*conn);
+	}
+	return conn->aborted ? ERR_ABRT : ERR_OK;
+}
+
+void SSDPHTTPServer::_onErrorStatic(void* arg, int8_t err) {
+	// pcb is already freed
+	Connection* conn = static_cast<Connection*>(arg);
+	conn->pcb = nullptr;
+	if (conn->pending) {
+		pbuf_free(conn->pending);
+		conn->pending = nullptr;
+	}
+	conn->body = nullptr;
+}
+
+void SSDPHTTPServer::Connection::reset() {
+	state = METHOD;
+	header = OTHER;
+	cr = 0;
+	cursor = 0;
+	buffer[0] = '\0';
+	uri[0] = '\0';
+	ifNoneMatch[0] = '\0';
+	head = false;
+	supported = false;
+	keepAlive = false;
+	acceptsGzip = false;
+	headerLen = 0;
+	headerSent = 0;
+	body = nullptr;
+	len = 0;
+	sent = 0;
+}
+
+void SSDPHTTPServer::Connection::close() {
+	if (!pcb)
+		return;
+
+	if (pending) {
+		pbuf_free(pending);
+		pending = nullptr;
+	}
+	body = nullptr;
+
+	tcp_arg(pcb, nullptr);
+	tcp_recv(pcb, nullptr);
+	tcp_sent(pcb, nullptr);
+	tcp_err(pcb, nullptr);
+	tcp_poll(pcb, nullptr, 0);
+	if (tcp_close(pcb) != ERR_OK) {
+		tcp_abort(pcb);
+		aborted = true;
+	}
+	pcb = nullptr;
+}
+
+void SSDPHTTPServer::Connection::abort() {
+	if (!pcb)
+		return;
+
+	if (pending) {
+		pbuf_free(pending);
+		pending = nullptr;
+	}
+	body = nullptr;
+
+	tcp_arg(pcb, nullptr);
+	tcp_recv(pcb, nullptr);
+	tcp_sent(pcb, nullptr);
+	tcp_err(pcb, nullptr);
+	tcp_poll(pcb, nullptr, 0);
+	tcp_abort(pcb);
+	aborted = true;
+	pcb = nullptr;
+}
+
+bool SSDPHTTPServer::Connection::feed(char c) {
+	(c == '\r' || c == '\n') ? cr++ : cr = 0;
+
+	switch (state) {
+	case METHOD:
+		if (c == ' ') {
+			head = !strcmp(buffer, "HEAD");
+			supported = head || !strcmp(buffer, "GET");
+			state = URI;
+			cursor = 0;
+		} else if (c != '\r' && c != '\n' && cursor < SSDP_HTTP_BUFFER_SIZE - 1) {
+			buffer[cursor++] = c;
+			buffer[cursor] = '\0';
+		}
+		break;
+	case URI:
+		if (c == ' ') {
+			state = PROTO;
+			cursor = 0;
+			buffer[0] = '\0';
+		} else if (c == '?') {
+			// query isn't used, skip it
+			cursor = sizeof(uri);
+		} else if (!(cursor == 0 && c == '/') && cursor < sizeof(uri) - 1) {
+			// documents are stored without leading slash, like schema URL
+			uri[cursor++] = c;
+			uri[cursor] = '\0';
+		}
+		break;
+	case PROTO:
+		if (cr == 2) {
+			keepAlive = !strcmp(buffer, "HTTP/1.1");
+			state = KEY;
+			cursor = 0;
+			buffer[0] = '\0';
+		} else if (c != '\r' && c != '\n' && cursor < SSDP_HTTP_BUFFER_SIZE - 1) {
+			buffer[cursor++] = c;
+			buffer[cursor] = '\0';
+		}
+		break;
+	case KEY:
+		if (cr == 4) {
+			return true;
+		} else if (cr == 2) {
+			// line without colon, skip it
+			cursor = 0;
+			buffer[0] = '\0';
+		} else if (c == ':') {
+			if (!strcasecmp(buffer, "Connection"))
+				header = CONNECTION;
+			else if (!strcasecmp(buffer, "Accept-Encoding"))
+				header = ACCEPT_ENCODING;
+			else if (!strcasecmp(buffer, "If-None-Match"))
+				header = IF_NONE_MATCH;
+			else
+				header = OTHER;
+			state = VALUE;
+			cursor = 0;
+			buffer[0] = '\0';
+		} else if (c != '\r' && c != '\n' && cursor < SSDP_HTTP_BUFFER_SIZE - 1) {
+			buffer[cursor++] = c;
+			buffer[cursor] = '\0';
+		}
+		break;
+	case VALUE:
+		if (cr == 2) {
+			if (header == CONNECTION) {
+				if (!strcasecmp(buffer, "close"))
+					keepAlive = false;
+				else if (!strcasecmp(buffer, "keep-alive"))
+					keepAlive = true;
+			} else if (header == ACCEPT_ENCODING) {
+				acceptsGzip = strstr(buffer, "gzip") != nullptr;
+			}
+			state = KEY;
+			header = OTHER;
+			cursor = 0;
+			buffer[0] = '\0';
+		} else if (c != '\r' && c != '\n' && (cursor > 0 || c != ' ')) {
+			char* value = (header == IF_NONE_MATCH) ? ifNoneMatch : buffer;
+			uint8_t size = (header == IF_NONE_MATCH) ? sizeof(ifNoneMatch) : sizeof(buffer);
+			if (cursor < size - 1) {
+				value[cursor++] = c;
+				value[cursor] = '\0';
+			}
+		}
+		break;
+	case SENDING:
+		break;
+	}
+	return false;
+}
@@ -0,0 +1,124 @@
+#ifndef ALMILUK_SSDP_HTTP_SERVER_H
+#define ALMILUK_SSDP_HTTP_SERVER_H
+
+#include "almilukESP8266SSDP.h"
+
+struct tcp_pcb;
+struct pbuf;
+
+// Size of the connection pool, connections above it are rejected
+#define SSDP_HTTP_CONNECTIONS		4
+// Schema and SCPD documents of all services
+#define SSDP_HTTP_DOCUMENTS			8
+#define SSDP_HTTP_BUFFER_SIZE		64
+#define SSDP_HTTP_ETAG_SIZE			32
+#define SSDP_HTTP_CHUNK_SIZE		256
+#define SSDP_HTTP_HEADER_SIZE		256
+// Idle keep-alive connections and stuck responses are closed after this time (ms)
+#define SSDP_HTTP_TIMEOUT			5000
+
+/* Non-blocking HTTP server for the description document and SCPD documents of services.
+* Bodies are prepared once and only copied to connections: the schema is rendered on first request
+* after any change, SCPD documents (and optionally their gzip-compressed copies) are supplied by the user.
+* Supports GET and HEAD, ETag with If-None-Match and keep-alive. Works on lwIP callbacks, no loop() calls are needed.
+*/
+class SSDPHTTPServer {
+public:
+	typedef std::function<void(Print& print)> Renderer;
+
+	// schema_url must stay valid, renderer prints the description document
+	SSDPHTTPServer(const char* schema_url, Renderer renderer) : _schemaURL(schema_url), _renderer(renderer) {};
+	~SSDPHTTPServer();
+
+	bool begin(uint16_t port);
+	void end();
+
+	// Schema will be rendered again on next request
+	void invalidateSchema() { _schemaValid = false; }
+	/* body and gzip_body must stay valid, they may be in PROGMEM.
+	* gzip_body is optional, it is sent to clients which accept gzip encoding.
+	*/
+	bool addDocument(const char* url, const char* body, size_t len, const uint8_t* gzip_body = nullptr, size_t gzip_len = 0);
+	bool hasDocument(const char* url) const;
+
+private:
+	struct Document {
+		char url[SSDP_SCHEMA_URL_SIZE];
+		const char* body;
+		size_t len;
+		const uint8_t* gzipBody;
+		size_t gzipLen;
+		uint32_t etag;
+	};
+
+	struct Connection {
+		enum State : uint8_t { METHOD, URI, PROTO, KEY, VALUE, SENDING };
+		enum Header : uint8_t { OTHER, CONNECTION, ACCEPT_ENCODING, IF_NONE_MATCH };
+
+		SSDPHTTPServer* server = nullptr;
+		tcp_pcb* pcb = nullptr;
+		unsigned long lastActivity = 0;
+
+		// Request
+		State state = METHOD;
+		Header header = OTHER;
+		uint8_t cr = 0;
+		uint8_t cursor = 0;
+		char buffer[SSDP_HTTP_BUFFER_SIZE];
+		char uri[SSDP_SCHEMA_URL_SIZE];
+		char ifNoneMatch[SSDP_HTTP_ETAG_SIZE];
+		bool head = false;
+		bool supported = false;
+		bool keepAlive = false;
+		bool acceptsGzip = false;
+		// Received data which isn't parsed yet (next request while response is being sent)
+		pbuf* pending = nullptr;
+		uint16_t pendingOffset = 0;
+		bool aborted = false;
+
+		// Response, the header is kept until it fits into the send buffer
+		char responseHeader[SSDP_HTTP_HEADER_SIZE];
+		uint16_t headerLen = 0;
+		uint16_t headerSent = 0;
+		const char* body = nullptr;
+		size_t len = 0;
+		size_t sent = 0;
+
+		// Prepares for the next request
+		void reset();
+		void close();
+		void abort();
+		// Returns true when the request is over
+		bool feed(char c);
+	};
+
+	Document* _findDocument(const char* url);
+	const Document* _schema();
+	bool _renderSchema();
+	bool _isSchemaSending() const;
+	void _respond(Connection& conn);
+	// Sends as much of the header and the body as the send buffer takes
+	void _sendResponse(Connection& conn);
+	void _process(Connection& conn);
+
+	static int8_t _onAcceptStatic(void* arg, tcp_pcb* pcb, int8_t err);
+	static int8_t _onRecvStatic(void* arg, tcp_pcb* pcb, pbuf* p, int8_t err);
+	static int8_t _onSentStatic(void* arg, tcp_pcb* pcb, uint16_t len);
+	static int8_t _onPollStatic(void* arg, tcp_pcb* pcb);
+	static void _onErrorStatic(void* arg, int8_t err);
+
+	const char* _schemaURL;
+	Renderer _renderer;
+	tcp_pcb* _listener = nullptr;
+	Connection _connections[SSDP_HTTP_CONNECTIONS];
+	Document _documents[SSDP_HTTP_DOCUMENTS];
+	uint8_t _documentsNum = 0;
+
+	// Pre-rendered schema
+	Document _schemaDocument;
+	char* _schemaBody = nullptr;
+	bool _schemaValid = false;
+	uint32_t _schemaAddr = 0;
+};
+
+#endif
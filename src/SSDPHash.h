@@ -0,0 +1,17 @@
+#ifndef ALMILUK_SSDP_HASH_H
+#define ALMILUK_SSDP_HASH_H
+
+#include <Arduino.h>
+
+// FNV-1a of len bytes, data may be in PROGMEM
+inline uint32_t _ssdp_hash(const char* data, size_t len, bool ignore_case = false) {
+	uint32_t hash = 2166136261UL;
+	for (size_t i = 0; i < len; i++) {
+		uint8_t c = pgm_read_byte(data + i);
+		hash ^= ignore_case ? (uint8_t)tolower(c) : c;
+		hash *= 16777619UL;
+	}
+	return hash;
+}
+
+#endif
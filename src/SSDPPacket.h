@@ -0,0 +1,43 @@
+#ifndef ALMILUK_SSDP_PACKET_H
+#define ALMILUK_SSDP_PACKET_H
+
+#include "almilukESP8266SSDP.h"
+
+#define SSDP_PORT		 1900
+// ssdp ipv6 is FF05::C
+// lwip-v2's igmp_joingroup only supports IPv4
+#define SSDP_MULTICAST_ADDR 239, 255, 255, 250
+// Bigger MX values are treated as this one (UPnP Device Architecture 2.0, 1.3.3)
+#define SSDP_MAX_MX		 5
+
+#define SSDP_USN_VAL_SIZE			(SSDP_UUID_SIZE + SSDP_ST_VAL_SIZE + 2)
+#define SSDP_NTS_SIZE				16
+#define SSDP_LOCATION_SIZE			128
+#define SSDP_SERVER_SIZE			64
+#define SSDP_USER_AGENT_SIZE		32
+
+extern const char _ssdp_search_template[];
+
+// Headers of a received SSDP message. Values that don't fit to the buffers are truncated.
+struct SSDPPacket {
+	enum Method { UNKNOWN, SEARCH, NOTIFY, RESPONSE };
+
+	Method method = UNKNOWN;
+	IPAddress remoteAddr;
+	uint16_t remotePort = 0;
+
+	uint16_t mx = 0;
+	// max-age from CACHE-CONTROL header, 0 if it is absent
+	uint32_t maxAge = 0;
+	// CONFIGID.UPNP.ORG header, -1 if it is absent
+	int32_t configId = -1;
+	// ST header for searches and responses, NT header for notifications
+	char target[SSDP_ST_VAL_SIZE] = { 0 };
+	char usn[SSDP_USN_VAL_SIZE] = { 0 };
+	char nts[SSDP_NTS_SIZE] = { 0 };
+	char location[SSDP_LOCATION_SIZE] = { 0 };
+	char server[SSDP_SERVER_SIZE] = { 0 };
+	char userAgent[SSDP_USER_AGENT_SIZE] = { 0 };
+};
+
+#endif
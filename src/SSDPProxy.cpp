@@ -0,0 +1,376 @@
+#ifndef LWIP_OPEN_SRC
+#define LWIP_OPEN_SRC
+#endif
+
+#include "SSDPProxy.h"
+#include "SSDPTrace.h"
+
+extern "C" {
+#include "user_interface.h"
+}
+
+#include "include/UdpContext.h"
+
+static const char _ssdp_proxy_response_template[] PROGMEM =
+"HTTP/1.1 200 OK\r\n"
+"EXT:\r\n"
+"CACHE-CONTROL: max-age=%u\r\n"
+"SERVER: %s\r\n"
+"USN: %s%s%s\r\n"
+"ST: %s\r\n"
+"LOCATION: %s\r\n"
+"\r\n";
+
+void SSDPProxy::handlePacket(const SSDPPacket& packet) {
+	Side side = _sideOf(packet.remoteAddr);
+	Entry* entry;
+	uint8_t target;
+
+	// Upstream hosts can't reach LOCATION of SoftAP devices, so only upstream devices are served to SoftAP clients
+	switch (packet.method) {
+	case SSDPPacket::SEARCH:
+		if (side != SOFTAP || !packet.target[0])
+			break;
+		if (_answer(packet, side) == 0
+			|| (_matchesManyDevices(packet.target) && !(_refreshed[UPSTREAM] && millis() - _refreshTime[UPSTREAM] < SSDP_PROXY_REFRESH_INTERVAL)))
+			_forward(packet, side);
+		break;
+	case SSDPPacket::NOTIFY:
+		if (side != UPSTREAM)
+			break;
+		if (!strcasecmp(packet.nts, "ssdp:alive"))
+			_store(packet, side, target);
+		else if (!strcasecmp(packet.nts, "ssdp:byebye"))
+			_remove(packet.usn);
+		break;
+	case SSDPPacket::RESPONSE:
+		if (side != UPSTREAM)
+			break;
+		entry = _store(packet, side, target);
+		if (entry)
+			_relay(*entry, target);
+		break;
+	default:
+		break;
+	}
+}
+
+bool SSDPProxy::sendNext(UdpContext* server) {
+	while (_queuedNum > 0) {
+		const Outgoing& outgoing = _queue[_queueHead];
+		_queueHead = (_queueHead + 1) % SSDP_PROXY_QUEUE_SIZE;
+		_queuedNum--;
+
+		// The entry or the search may be gone while the datagram was waiting
+		if (outgoing.kind == Outgoing::RESPONSE) {
+			const Entry& entry = _cache[outgoing.index];
+			if (entry.generation != outgoing.generation || !_isAlive(entry, millis()))
+				continue;
+			_sendResponse(server, entry, outgoing.target, outgoing.addr, outgoing.port);
+		} else {
+			const PendingSearch& pending = _pending[outgoing.index];
+			if (!pending.active)
+				continue;
+			_sendSearch(server, pending, outgoing.mx);
+		}
+		return true;
+	}
+	return false;
+}
+
+void SSDPProxy::clear() {
+	for (Entry& entry : _cache) {
+		entry.valid = false;
+		entry.generation++;
+	}
+	for (PendingSearch& pending : _pending)
+		pending.active = false;
+	_queueHead = 0;
+	_queuedNum = 0;
+	_refreshed[UPSTREAM] = _refreshed[SOFTAP] = false;
+}
+
+uint8_t SSDPProxy::getCachedNum() const {
+	unsigned long now = millis();
+	uint8_t num = 0;
+	for (const Entry& entry : _cache)
+		if (_isAlive(entry, now))
+			num++;
+	return num;
+}
+
+SSDPProxy::Side SSDPProxy::_sideOf(const IPAddress& addr) {
+	struct ip_info info;
+	if (wifi_get_ip_info(SOFTAP_IF, &info) && info.ip.addr != 0
+		&& ((uint32_t)addr & info.netmask.addr) == (info.ip.addr & info.netmask.addr))
+		return SOFTAP;
+	return UPSTREAM;
+}
+
+IPAddress SSDPProxy::_interfaceAddr(Side side) {
+	struct ip_info info;
+	if (!wifi_get_ip_info(side == SOFTAP ? SOFTAP_IF : STATION_IF, &info))
+		return IPAddress();
+	return IPAddress(info.ip.addr);
+}
+
+bool SSDPProxy::_isAlive(const Entry& entry, unsigned long now) {
+	return entry.valid && (long)(entry.expires - now) > 0;
+}
+
+bool SSDPProxy::_targetMatches(const char* search_target, const char* target) {
+	return !strcasecmp(search_target, "ssdp:all") || !strcasecmp(search_target, target);
+}
+
+bool SSDPProxy::_matchesManyDevices(const char* search_target) {
+	return !strcasecmp(search_target, "ssdp:all") || !strcasecmp(search_target, "upnp:rootdevice");
+}
+
+const char* SSDPProxy::_targetOf(const Entry& entry, uint8_t target) {
+	if (target == ROOT_DEVICE)
+		return "upnp:rootdevice";
+	if (target == UUID)
+		return entry.uuid;
+	return entry.targets[target];
+}
+
+SSDPProxy::Entry* SSDPProxy::_find(const char* uuid, size_t uuid_len) {
+	for (Entry& entry : _cache)
+		if (entry.valid && strlen(entry.uuid) == uuid_len && !strncasecmp(entry.uuid, uuid, uuid_len))
+			return &entry;
+	return nullptr;
+}
+
+SSDPProxy::Entry* SSDPProxy::_store(const SSDPPacket& packet, Side side, uint8_t& target) {
+	if (!packet.usn[0] || !packet.target[0] || !packet.location[0])
+		return nullptr;
+
+	// USN is "uuid:<device-UUID>" or "uuid:<device-UUID>::<target>"
+	const char* separator = strstr(packet.usn, "::");
+	size_t uuid_len = separator ? (size_t)(separator - packet.usn) : strlen(packet.usn);
+	if (strncasecmp(packet.usn, "uuid:", 5) || uuid_len >= SSDP_PROXY_UUID_SIZE)
+		return nullptr;
+
+	unsigned long now = millis();
+	Entry* slot = _find(packet.usn, uuid_len);
+	if (!slot) {
+		// Take free or expired entry, otherwise evict the one which expires first
+		for (Entry& entry : _cache) {
+			if (!_isAlive(entry, now)) {
+				slot = &entry;
+				break;
+			}
+			if (!slot || (long)(entry.expires - slot->expires) < 0)
+				slot = &entry;
+		}
+		// Evicted device may still be alive, searches can't be answered from the cache only
+		if (_isAlive(*slot, now))
+			_refreshed[side] = false;
+
+		slot->valid = true;
+		slot->generation++;
+		slot->rootDevice = false;
+		slot->targetsNum = 0;
+		memcpy(slot->uuid, packet.usn, uuid_len);
+		slot->uuid[uuid_len] = '\0';
+	}
+
+	uint32_t max_age = packet.maxAge ? packet.maxAge : SSDP_PROXY_DEFAULT_MAX_AGE;
+	if (max_age > SSDP_PROXY_MAX_AGE)
+		max_age = SSDP_PROXY_MAX_AGE;
+
+	slot->side = side;
+	slot->expires = now + max_age * 1000UL;
+	strlcpy(slot->location, packet.location, sizeof(slot->location));
+	strlcpy(slot->server, packet.server, sizeof(slot->server));
+
+	if (!strcasecmp(packet.target, "upnp:rootdevice")) {
+		slot->rootDevice = true;
+		target = ROOT_DEVICE;
+	} else if (!strncasecmp(packet.target, "uuid:", 5)) {
+		target = UUID;
+	} else {
+		for (target = 0; target < slot->targetsNum; target++)
+			if (!strcasecmp(slot->targets[target], packet.target))
+				break;
+		if (target == slot->targetsNum) {
+			// The device stays cached, but the type isn't
+			if (slot->targetsNum == SSDP_PROXY_DEVICE_TARGETS || strlen(packet.target) >= SSDP_PROXY_TARGET_SIZE)
+				return nullptr;
+			strlcpy(slot->targets[slot->targetsNum++], packet.target, SSDP_PROXY_TARGET_SIZE);
+		}
+	}
+	return slot;
+}
+
+void SSDPProxy::_remove(const char* usn) {
+	const char* separator = strstr(usn, "::");
+	Entry* entry = _find(usn, separator ? (size_t)(separator - usn) : strlen(usn));
+	if (entry) {
+		entry->valid = false;
+		entry->generation++;
+	}
+}
+
+uint8_t SSDPProxy::_answer(const SSDPPacket& packet, Side from) {
+	unsigned long now = millis();
+	bool all = !strcasecmp(packet.target, "ssdp:all");
+	uint8_t hits = 0;
+	for (uint8_t i = 0; i < SSDP_PROXY_CACHE_SIZE; i++) {
+		const Entry& entry = _cache[i];
+		if (entry.side == from || !_isAlive(entry, now))
+			continue;
+
+		// Answers which don't fit to the queue aren't sent, so the search is forwarded if none fits
+		if (entry.rootDevice && (all || !strcasecmp(packet.target, "upnp:rootdevice"))
+			&& _enqueue(Outgoing::RESPONSE, i, ROOT_DEVICE, 0, packet.remoteAddr, packet.remotePort))
+			hits++;
+		if (_targetMatches(packet.target, entry.uuid)
+			&& _enqueue(Outgoing::RESPONSE, i, UUID, 0, packet.remoteAddr, packet.remotePort))
+			hits++;
+		for (uint8_t target = 0; target < entry.targetsNum; target++)
+			if (_targetMatches(packet.target, entry.targets[target])
+				&& _enqueue(Outgoing::RESPONSE, i, target, 0, packet.remoteAddr, packet.remotePort))
+				hits++;
+	}
+	return hits;
+}
+
+void SSDPProxy::_forward(const SSDPPacket& packet, Side from) {
+	Side to = (from == UPSTREAM) ? SOFTAP : UPSTREAM;
+	unsigned long now = millis();
+
+	// Searches of other requesters which are still waiting for responses aren't taken over
+	PendingSearch* pending = _pendingFor(packet, to);
+	if (!pending) {
+		#ifdef DEBUG_SSDP
+			DEBUG_SSDP.printf("SSDP proxy: search for %s is not forwarded (too many pending searches)\n", packet.target);
+		#endif
+		return;
+	}
+
+	uint16_t mx = packet.mx;
+	if (mx < 1)
+		mx = 1;
+	else if (mx > SSDP_MAX_MX)
+		mx = SSDP_MAX_MX;
+
+	pending->active = true;
+	pending->side = to;
+	pending->addr = packet.remoteAddr;
+	pending->port = packet.remotePort;
+	pending->until = now + mx * 1000UL;
+	strlcpy(pending->target, packet.target, sizeof(pending->target));
+
+	// The requester still gets matching responses to the search forwarded before
+	if (_forwarded[to] && now - _forwardTime[to] < SSDP_PROXY_FORWARD_INTERVAL) {
+		#ifdef DEBUG_SSDP
+			DEBUG_SSDP.printf("SSDP proxy: search for %s is not forwarded (rate limit)\n", packet.target);
+		#endif
+		return;
+	}
+
+	if (!_enqueue(Outgoing::FORWARD, pending - _pending, 0, mx, IPAddress(SSDP_MULTICAST_ADDR), SSDP_PORT))
+		return;
+
+	_forwarded[to] = true;
+	_forwardTime[to] = now;
+	// Responses of all devices come to the cache
+	if (_matchesManyDevices(packet.target)) {
+		_refreshed[to] = true;
+		_refreshTime[to] = now;
+	}
+
+	#ifdef DEBUG_SSDP
+		DEBUG_SSDP.printf("SSDP proxy: search for %s is forwarded\n", packet.target);
+	#endif
+}
+
+SSDPProxy::PendingSearch* SSDPProxy::_pendingFor(const SSDPPacket& packet, Side to) {
+	unsigned long now = millis();
+	PendingSearch* free = nullptr;
+	for (PendingSearch& pending : _pending) {
+		if (pending.active && (long)(now - pending.until) >= 0)
+			pending.active = false;
+
+		// Repeated search of the same requester
+		if (pending.active && pending.side == to && pending.port == packet.remotePort
+			&& pending.addr == packet.remoteAddr)
+			return &pending;
+		if (!pending.active && !free)
+			free = &pending;
+	}
+	return free;
+}
+
+void SSDPProxy::_relay(const Entry& entry, uint8_t target) {
+	unsigned long now = millis();
+	for (PendingSearch& pending : _pending) {
+		if (!pending.active || pending.side != entry.side)
+			continue;
+
+		if ((long)(now - pending.until) >= 0) {
+			pending.active = false;
+			continue;
+		}
+
+		if (_targetMatches(pending.target, _targetOf(entry, target)))
+			_enqueue(Outgoing::RESPONSE, &entry - _cache, target, 0, pending.addr, pending.port);
+	}
+}
+
+bool SSDPProxy::_enqueue(Outgoing::Kind kind, uint8_t index, uint8_t target, uint8_t mx, const IPAddress& addr, uint16_t port) {
+	if (_queuedNum == SSDP_PROXY_QUEUE_SIZE) {
+		#ifdef DEBUG_SSDP
+			DEBUG_SSDP.printf("SSDP proxy: queue is full, datagram is dropped\n");
+		#endif
+		return false;
+	}
+
+	Outgoing& outgoing = _queue[(_queueHead + _queuedNum++) % SSDP_PROXY_QUEUE_SIZE];
+	outgoing.kind = kind;
+	outgoing.index = index;
+	outgoing.generation = (kind == Outgoing::RESPONSE) ? _cache[index].generation : 0;
+	outgoing.target = target;
+	outgoing.mx = mx;
+	outgoing.addr = addr;
+	outgoing.port = port;
+	return true;
+}
+
+void SSDPProxy::_sendResponse(UdpContext* server, const Entry& entry, uint8_t target, const IPAddress& addr, uint16_t port) {
+	const char* st = _targetOf(entry, target);
+	char buffer[SSDP_PROXY_MESSAGE_SIZE];
+	int len = snprintf_P(buffer, sizeof(buffer), _ssdp_proxy_response_template,
+		(unsigned int)((entry.expires - millis()) / 1000),
+		entry.server,
+		entry.uuid, target == UUID ? "" : "::", target == UUID ? "" : st,
+		st,
+		entry.location
+	);
+	if (len <= 0 || len >= (int)sizeof(buffer))
+		return;
+
+	if (_trace)
+		_trace->record(SSDPTrace::TX, _interfaceAddr(_sideOf(addr)), SSDP_PORT, addr, port, buffer, len);
+	server->append(buffer, len);
+	server->send(addr, port);
+}
+
+void SSDPProxy::_sendSearch(UdpContext* server, const PendingSearch& pending, uint8_t mx) {
+	IPAddress interface_addr = _interfaceAddr(pending.side);
+	if (!interface_addr.isSet())
+		return;
+
+	char buffer[SSDP_PROXY_MESSAGE_SIZE];
+	int len = snprintf_P(buffer, sizeof(buffer), _ssdp_search_template, mx, pending.target);
+	if (len <= 0 || len >= (int)sizeof(buffer))
+		return;
+
+	if (_trace)
+		_trace->record(SSDPTrace::TX, interface_addr, SSDP_PORT, IPAddress(SSDP_MULTICAST_ADDR), SSDP_PORT, buffer, len);
+	server->append(buffer, len);
+	server->setMulticastInterface(interface_addr);
+	server->send(IPAddress(SSDP_MULTICAST_ADDR), SSDP_PORT);
+	server->setMulticastInterface(_interfaceAddr(UPSTREAM));
+}
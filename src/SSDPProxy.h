@@ -0,0 +1,130 @@
+#ifndef ALMILUK_SSDP_PROXY_H
+#define ALMILUK_SSDP_PROXY_H
+
+#include "SSDPPacket.h"
+
+class UdpContext;
+class SSDPTrace;
+
+// Number of cached devices, each one takes about 600 bytes
+#define SSDP_PROXY_CACHE_SIZE			4
+// Device type and service types of a device, other types of it aren't cached
+#define SSDP_PROXY_DEVICE_TARGETS		6
+#define SSDP_PROXY_TARGET_SIZE			64
+#define SSDP_PROXY_UUID_SIZE			48
+#define SSDP_PROXY_LOCATION_SIZE		96
+#define SSDP_PROXY_SERVER_SIZE			48
+#define SSDP_PROXY_MESSAGE_SIZE			512
+// Number of requesters of forwarded searches which get relayed responses at once
+#define SSDP_PROXY_PENDING_SIZE			4
+// Responses and forwarded searches waiting to be sent (about 16 bytes each), the ones above it are dropped
+#define SSDP_PROXY_QUEUE_SIZE			24
+// Minimal period (ms) between searches forwarded to the same side
+#define SSDP_PROXY_FORWARD_INTERVAL		1000
+// Searches which may match many devices are answered only from the cache for this time (ms)
+// after such search was forwarded, unless a device was evicted from the cache since then
+#define SSDP_PROXY_REFRESH_INTERVAL		60000
+// Used for announcements without CACHE-CONTROL header, and as upper limit for the others (seconds)
+#define SSDP_PROXY_DEFAULT_MAX_AGE		1800
+#define SSDP_PROXY_MAX_AGE				86400
+
+/* Caching SSDP proxy for SoftAP clients. Announcements (NOTIFY ssdp:alive and search responses) seen
+* in upstream (station) network are cached per device, and searches of SoftAP clients are answered
+* from the cache without any traffic in upstream network. The cache takes about 2.5 KB.
+* Cache misses are forwarded upstream at most once per SSDP_PROXY_FORWARD_INTERVAL ms. Searches which
+* may match many devices (ssdp:all, upnp:rootdevice) are forwarded too, because the cache may not know
+* all of them, but at most once per SSDP_PROXY_REFRESH_INTERVAL ms. Responses to forwarded searches
+* are relayed to the requesters until their MX windows end.
+* SoftAP clients reach upstream LOCATION addresses only if NAPT is enabled on SoftAP interface
+* (see examples/proxy). Upstream hosts can't reach SoftAP addresses, so the proxy works in this direction only.
+* Nothing is sent from handlePacket(), datagrams are queued and sent one by one with sendNext().
+*/
+class SSDPProxy {
+public:
+	enum Side : uint8_t { UPSTREAM, SOFTAP };
+
+	void handlePacket(const SSDPPacket& packet);
+	// Sends the oldest queued datagram, returns false if there is nothing to send
+	bool sendNext(UdpContext* server);
+	void clear();
+	// Number of cached devices
+	uint8_t getCachedNum() const;
+	uint8_t getQueuedNum() const { return _queuedNum; }
+	// Sent datagrams are recorded to the trace if it is set
+	void setTrace(SSDPTrace* trace) { _trace = trace; }
+
+private:
+	// Announced targets of a device besides its types
+	enum Target : uint8_t { ROOT_DEVICE = 0xFE, UUID = 0xFF };
+
+	// Device with all its announced targets, USN of each of them is "<uuid>::<target>" (or "<uuid>" for UUID)
+	struct Entry {
+		bool valid = false;
+		Side side = UPSTREAM;
+		// Changed when the entry is removed or taken by another device, so queued responses with it are dropped
+		uint8_t generation = 0;
+		bool rootDevice = false;
+		uint8_t targetsNum = 0;
+		unsigned long expires = 0;
+		char uuid[SSDP_PROXY_UUID_SIZE];
+		char location[SSDP_PROXY_LOCATION_SIZE];
+		char server[SSDP_PROXY_SERVER_SIZE];
+		char targets[SSDP_PROXY_DEVICE_TARGETS][SSDP_PROXY_TARGET_SIZE];
+	};
+
+	// Search forwarded to the side, responses to it are relayed to the requester
+	struct PendingSearch {
+		bool active = false;
+		Side side = UPSTREAM;
+		IPAddress addr;
+		uint16_t port = 0;
+		unsigned long until = 0;
+		char target[SSDP_PROXY_TARGET_SIZE];
+	};
+
+	// Datagram waiting to be sent, it refers to the cache entry or the pending search
+	struct Outgoing {
+		enum Kind : uint8_t { RESPONSE, FORWARD };
+		Kind kind = RESPONSE;
+		uint8_t index = 0;			// of the entry for RESPONSE, of the pending search for FORWARD
+		uint8_t generation = 0;		// of the entry
+		uint8_t target = 0;			// of the entry: Target or index of its type
+		uint8_t mx = 0;
+		IPAddress addr;
+		uint16_t port = 0;
+	};
+
+	static Side _sideOf(const IPAddress& addr);
+	static IPAddress _interfaceAddr(Side side);
+	static bool _isAlive(const Entry& entry, unsigned long now);
+	static bool _targetMatches(const char* search_target, const char* target);
+	static bool _matchesManyDevices(const char* search_target);
+	static const char* _targetOf(const Entry& entry, uint8_t target);
+
+	Entry* _find(const char* uuid, size_t uuid_len);
+	// Returns nullptr if the announcement isn't cached, target is set to the announced one
+	Entry* _store(const SSDPPacket& packet, Side side, uint8_t& target);
+	void _remove(const char* usn);
+	uint8_t _answer(const SSDPPacket& packet, Side from);
+	void _forward(const SSDPPacket& packet, Side from);
+	PendingSearch* _pendingFor(const SSDPPacket& packet, Side to);
+	void _relay(const Entry& entry, uint8_t target);
+	// Returns false if the queue is full
+	bool _enqueue(Outgoing::Kind kind, uint8_t index, uint8_t target, uint8_t mx, const IPAddress& addr, uint16_t port);
+	void _sendResponse(UdpContext* server, const Entry& entry, uint8_t target, const IPAddress& addr, uint16_t port);
+	void _sendSearch(UdpContext* server, const PendingSearch& pending, uint8_t mx);
+
+	Entry _cache[SSDP_PROXY_CACHE_SIZE];
+	PendingSearch _pending[SSDP_PROXY_PENDING_SIZE];
+	Outgoing _queue[SSDP_PROXY_QUEUE_SIZE];
+	uint8_t _queueHead = 0;
+	uint8_t _queuedNum = 0;
+	unsigned long _forwardTime[2] = { 0, 0 };
+	bool _forwarded[2] = { false, false };
+	// Time of the last forwarded search which may match many devices, and whether the cache is complete since
+	unsigned long _refreshTime[2] = { 0, 0 };
+	bool _refreshed[2] = { false, false };
+	SSDPTrace* _trace = nullptr;
+};
+
+#endif
@@ -0,0 +1,93 @@
+#include "SSDPSearchStats.h"
+#include "SSDPHash.h"
+
+template <typename T>
+void SSDPSearchStats::Top<T>::add(uint32_t key, const char* label, bool keep_end) {
+	uint8_t index = 0;
+	while (index < _size && _entries[index].key != key)
+		index++;
+
+	if (index == _size) {
+		if (_size < SSDP_STATS_TOP_SIZE) {
+			_size++;
+			_entries[index].count = 0;
+			_entries[index].error = 0;
+		} else {
+			// The least frequent value is replaced, new one inherits its count as possible error
+			index = _size - 1;
+			_entries[index].error = _entries[index].count;
+		}
+		_entries[index].key = key;
+		_setLabel(_entries[index], label, keep_end);
+	}
+	_entries[index].count++;
+
+	// Keep the order
+	while (index > 0 && _entries[index].count > _entries[index - 1].count) {
+		T entry = _entries[index];
+		_entries[index] = _entries[index - 1];
+		_entries[index - 1] = entry;
+		index--;
+	}
+}
+
+template <typename T>
+void SSDPSearchStats::Top<T>::_setLabel(Entry& entry, const char* label, bool keep_end) {
+	size_t len = strlen(label);
+	if (!keep_end || len < sizeof(entry.label)) {
+		strlcpy(entry.label, label, sizeof(entry.label));
+		return;
+	}
+
+	const char* end = label + len - (sizeof(entry.label) - 4);
+	const char* colon = strchr(end, ':');
+	snprintf(entry.label, sizeof(entry.label), "...%s", colon ? colon : end);
+}
+
+template class SSDPSearchStats::Top<SSDPSearchStats::Counter>;
+template class SSDPSearchStats::Top<SSDPSearchStats::Entry>;
+
+void SSDPSearchStats::record(const SSDPPacket& packet) {
+	if (packet.method != SSDPPacket::SEARCH)
+		return;
+
+	_searchesNum++;
+	_targets.add(_ssdp_hash(packet.target, strlen(packet.target), true), packet.target, true);
+	_requesters.add(packet.remoteAddr);
+	_userAgents.add(_ssdp_hash(packet.userAgent, strlen(packet.userAgent), true), packet.userAgent);
+}
+
+void SSDPSearchStats::reset() {
+	_searchesNum = 0;
+	_targets.clear();
+	_requesters.clear();
+	_userAgents.clear();
+}
+
+size_t SSDPSearchStats::printTo(Print& print) const {
+	size_t len = print.printf("SSDP searches: %u\n", (unsigned int)_searchesNum);
+	len += _printTop(print, "ST", _targets);
+	len += _printTop(print, "Requesters", _requesters);
+	len += _printTop(print, "User-Agent", _userAgents);
+	return len;
+}
+
+template <typename T>
+size_t SSDPSearchStats::_printTop(Print& print, const char* title, const Top<T>& top) {
+	size_t len = print.printf("%s:\n", title);
+	for (uint8_t i = 0; i < top.getSize(); i++) {
+		const T& entry = top.getEntry(i);
+		len += print.printf("\t%u (+%u)\t", (unsigned int)entry.count, (unsigned int)entry.error);
+		len += _printValue(print, entry);
+		len += print.print('\n');
+	}
+	return len;
+}
+
+size_t SSDPSearchStats::_printValue(Print& print, const Counter& entry) {
+	return print.print(IPAddress(entry.key));
+}
+
+size_t SSDPSearchStats::_printValue(Print& print, const Entry& entry) {
+	return print.print(entry.label[0] ? entry.label : "-");
+}
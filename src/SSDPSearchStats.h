@@ -0,0 +1,72 @@
+#ifndef ALMILUK_SSDP_SEARCH_STATS_H
+#define ALMILUK_SSDP_SEARCH_STATS_H
+
+#include "SSDPPacket.h"
+
+// Number of tracked values of each kind
+#define SSDP_STATS_TOP_SIZE			4
+// Values are stored truncated to this size (with terminating zero),
+// ST values keep their end ("...:service:ContentDirectory:1"), User-Agents their beginning
+#define SSDP_STATS_LABEL_SIZE		32
+
+/* Streaming summary of received search requests: most frequent ST values, requester addresses and User-Agents.
+* Each kind is tracked by space-saving top-K algorithm with SSDP_STATS_TOP_SIZE counters, so memory is fixed
+* (about 420 bytes) and cost per packet is constant. Counts of values which entered the top after
+* eviction of other values are overestimated by at most error of the entry.
+*/
+class SSDPSearchStats : public Printable {
+public:
+	struct Counter {
+		uint32_t key = 0;		// hash of the value, IPv4 address for requesters
+		uint32_t count = 0;
+		uint32_t error = 0;		// upper bound of overestimation of count
+	};
+
+	// Counter of ST value or User-Agent, requesters are identified by their key only
+	struct Entry : Counter {
+		char label[SSDP_STATS_LABEL_SIZE] = { 0 };
+	};
+
+	template <typename T>
+	class Top {
+	public:
+		// Entries are sorted by count, the most frequent first
+		uint8_t getSize() const { return _size; }
+		const T& getEntry(uint8_t index) const { return _entries[index]; }
+
+		// Label is stored only by entries with it. With keep_end, a long label is stored as "..."
+		// and its end, cut at ':' if there is one
+		void add(uint32_t key, const char* label = nullptr, bool keep_end = false);
+		void clear() { _size = 0; }
+
+	private:
+		static void _setLabel(Counter& entry, const char* label, bool keep_end) {}
+		static void _setLabel(Entry& entry, const char* label, bool keep_end);
+
+		T _entries[SSDP_STATS_TOP_SIZE];
+		uint8_t _size = 0;
+	};
+
+	void record(const SSDPPacket& packet);
+	void reset();
+
+	uint32_t getSearchesNum() const { return _searchesNum; }
+	const Top<Entry>& getTargets() const { return _targets; }
+	const Top<Counter>& getRequesters() const { return _requesters; }
+	const Top<Entry>& getUserAgents() const { return _userAgents; }
+
+	size_t printTo(Print& print) const override;
+
+private:
+	template <typename T>
+	static size_t _printTop(Print& print, const char* title, const Top<T>& top);
+	static size_t _printValue(Print& print, const Counter& entry);
+	static size_t _printValue(Print& print, const Entry& entry);
+
+	uint32_t _searchesNum = 0;
+	Top<Entry> _targets;
+	Top<Counter> _requesters;
+	Top<Entry> _userAgents;
+};
+
+#endif
@@ -0,0 +1,165 @@
+#include "SSDPTrace.h"
+#include "SSDPPacket.h"
+
+#define SSDP_TRACE_IP_HEADER_SIZE	20
+#define SSDP_TRACE_UDP_HEADER_SIZE	8
+#define SSDP_TRACE_MARKER_ADDR		127, 0, 0, 1
+
+// pcap headers are written in the byte order of the device, readers detect it by the magic number
+struct SSDPPcapHeader {
+	uint32_t magic;
+	uint16_t versionMajor;
+	uint16_t versionMinor;
+	int32_t thisZone;
+	uint32_t sigfigs;
+	uint32_t snapLen;
+	uint32_t linkType;
+};
+
+struct SSDPPcapRecordHeader {
+	uint32_t sec;
+	uint32_t usec;
+	uint32_t inclLen;
+	uint32_t origLen;
+};
+
+void SSDPTrace::begin(Kind kind, size_t len) {
+	if (_recordsNum < SSDP_TRACE_RECORDS)
+		_recordsNum++;
+	else
+		_overwrittenNum++;
+
+	_current = &_records[_next];
+	_next = (_next + 1) % SSDP_TRACE_RECORDS;
+
+	_current->time = millis();
+	_current->kind = kind;
+	_current->src = _current->dst = 0;
+	_current->srcPort = _current->dstPort = 0;
+	_current->origLen = len > 0xFFFF ? 0xFFFF : len;
+	_current->capLen = 0;
+	_written = 0;
+}
+
+void SSDPTrace::append(const char* data, size_t len) {
+	if (_current && _current->capLen < SSDP_TRACE_SNAP_SIZE) {
+		size_t size = SSDP_TRACE_SNAP_SIZE - _current->capLen;
+		if (size > len)
+			size = len;
+		memcpy(_current->data + _current->capLen, data, size);
+		_current->capLen += size;
+	}
+	_written += len;
+}
+
+void SSDPTrace::commit(uint32_t src, uint16_t src_port, uint32_t dst, uint16_t dst_port) {
+	if (!_current)
+		return;
+
+	_current->src = src;
+	_current->srcPort = src_port;
+	_current->dst = dst;
+	_current->dstPort = dst_port;
+	if (_written > _current->origLen)
+		_current->origLen = _written > 0xFFFF ? 0xFFFF : _written;
+	_current = nullptr;
+}
+
+void SSDPTrace::record(Kind kind, uint32_t src, uint16_t src_port, uint32_t dst, uint16_t dst_port, const char* data, size_t len) {
+	begin(kind, len);
+	append(data, len);
+	commit(src, src_port, dst, dst_port);
+}
+
+void SSDPTrace::mark(PGM_P format, ...) {
+	char buffer[SSDP_TRACE_SNAP_SIZE];
+	va_list args;
+	va_start(args, format);
+	int len = vsnprintf_P(buffer, sizeof(buffer), format, args);
+	va_end(args);
+	if (len < 0)
+		return;
+	if (len >= (int)sizeof(buffer))
+		len = sizeof(buffer) - 1;
+
+	uint32_t addr = IPAddress(SSDP_TRACE_MARKER_ADDR);
+	record(MARKER, addr, SSDP_PORT, addr, SSDP_TRACE_MARKER_PORT, buffer, len);
+}
+
+void SSDPTrace::clear() {
+	_current = nullptr;
+	_next = 0;
+	_recordsNum = 0;
+	_overwrittenNum = 0;
+}
+
+size_t SSDPTrace::dump(Print& print, uint32_t now) const {
+	SSDPPcapHeader header;
+	header.magic = 0xA1B2C3D4;
+	header.versionMajor = 2;
+	header.versionMinor = 4;
+	header.thisZone = 0;
+	header.sigfigs = 0;
+	header.snapLen = SSDP_TRACE_IP_HEADER_SIZE + SSDP_TRACE_UDP_HEADER_SIZE + SSDP_TRACE_SNAP_SIZE;
+	header.linkType = SSDP_TRACE_LINKTYPE;
+	size_t written = print.write((const uint8_t*)&header, sizeof(header));
+
+	unsigned long now_ms = millis();
+	// From the oldest record to the newest one
+	uint8_t index = (_next + SSDP_TRACE_RECORDS - _recordsNum) % SSDP_TRACE_RECORDS;
+	for (uint8_t i = 0; i < _recordsNum; i++) {
+		const Record& record = _records[(index + i) % SSDP_TRACE_RECORDS];
+		// Unfinished record
+		if (&record == _current)
+			continue;
+		written += _dumpRecord(print, record, now_ms, now);
+	}
+	return written;
+}
+
+size_t SSDPTrace::_dumpRecord(Print& print, const Record& record, unsigned long now_ms, uint32_t now) {
+	uint64_t time_ms = record.time;
+	if (now)
+		time_ms = (uint64_t)now * 1000 - (now_ms - record.time);
+
+	uint16_t udp_len = SSDP_TRACE_UDP_HEADER_SIZE + record.origLen;
+	uint16_t ip_len = SSDP_TRACE_IP_HEADER_SIZE + udp_len;
+
+	SSDPPcapRecordHeader header;
+	header.sec = time_ms / 1000;
+	header.usec = (time_ms % 1000) * 1000;
+	header.inclLen = SSDP_TRACE_IP_HEADER_SIZE + SSDP_TRACE_UDP_HEADER_SIZE + record.capLen;
+	header.origLen = ip_len;
+
+	// Network byte order
+	uint8_t ip[SSDP_TRACE_IP_HEADER_SIZE] = {
+		0x45, 0, (uint8_t)(ip_len >> 8), (uint8_t)ip_len,
+		0, 0, 0, 0,
+		1, 17, 0, 0 // TTL, UDP, checksum
+	};
+	// Addresses are stored in network byte order already
+	memcpy(ip + 12, &record.src, 4);
+	memcpy(ip + 16, &record.dst, 4);
+	uint32_t sum = 0;
+	for (uint8_t i = 0; i < sizeof(ip); i += 2)
+		sum += (ip[i] << 8) | ip[i + 1];
+	while (sum >> 16)
+		sum = (sum & 0xFFFF) + (sum >> 16);
+	sum = ~sum;
+	ip[10] = sum >> 8;
+	ip[11] = sum;
+
+	// Checksum 0 means that it isn't calculated
+	uint8_t udp[SSDP_TRACE_UDP_HEADER_SIZE] = {
+		(uint8_t)(record.srcPort >> 8), (uint8_t)record.srcPort,
+		(uint8_t)(record.dstPort >> 8), (uint8_t)record.dstPort,
+		(uint8_t)(udp_len >> 8), (uint8_t)udp_len,
+		0, 0
+	};
+
+	size_t written = print.write((const uint8_t*)&header, sizeof(header));
+	written += print.write(ip, sizeof(ip));
+	written += print.write(udp, sizeof(udp));
+	written += print.write((const uint8_t*)record.data, record.capLen);
+	return written;
+}
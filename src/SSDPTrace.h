@@ -0,0 +1,78 @@
+#ifndef ALMILUK_SSDP_TRACE_H
+#define ALMILUK_SSDP_TRACE_H
+
+#include "almilukESP8266SSDP.h"
+
+// Number of records in the ring, the oldest ones are overwritten
+#define SSDP_TRACE_RECORDS			16
+// Datagrams are truncated to this size
+#define SSDP_TRACE_SNAP_SIZE		128
+// Markers are exported as UDP datagrams 127.0.0.1:SSDP_PORT -> 127.0.0.1:SSDP_TRACE_MARKER_PORT
+#define SSDP_TRACE_MARKER_PORT		19000
+// LINKTYPE_RAW, records start with IPv4 header
+#define SSDP_TRACE_LINKTYPE			101
+
+/* Fixed-size in-RAM ring of received and sent SSDP datagrams for field debugging.
+* Every record stores reception/sending time (millis), addresses and the first SSDP_TRACE_SNAP_SIZE bytes of datagram.
+* Parse decisions ("accept ..." or "reject <reason> ...") are stored as marker records right after the datagram.
+* dump() writes the ring to any Print in pcap format with synthesized IPv4/UDP headers, so it can be opened in Wireshark.
+* extras/ssdp_trace.py captures the traffic on a host in the same format.
+*
+* Records are written from the context where SSDP works (timer callback in autorun mode),
+* so call dump() and clear() from the same context or accept a possibly torn last record.
+*/
+class SSDPTrace {
+public:
+	enum Kind : uint8_t { RX, TX, MARKER };
+
+	// Starts new record, len is the full datagram length if it is known
+	void begin(Kind kind, size_t len = 0);
+	void append(const char* data, size_t len);
+	void append(char c) {
+		if (_current && _current->capLen < SSDP_TRACE_SNAP_SIZE)
+			_current->data[_current->capLen++] = c;
+		_written++;
+	}
+	bool isFull() const { return !_current || _current->capLen >= SSDP_TRACE_SNAP_SIZE; }
+	// Finishes the record started by begin()
+	void commit(uint32_t src, uint16_t src_port, uint32_t dst, uint16_t dst_port);
+	// Whole datagram at once
+	void record(Kind kind, uint32_t src, uint16_t src_port, uint32_t dst, uint16_t dst_port, const char* data, size_t len);
+	// Adds marker record, format is in PROGMEM
+	void mark(PGM_P format, ...);
+
+	void clear();
+	uint8_t getRecordsNum() const { return _recordsNum; }
+	// Number of records which were overwritten since last clear()
+	uint32_t getOverwrittenNum() const { return _overwrittenNum; }
+
+	/* Writes pcap file to the print. If now (current UNIX time, seconds) is set,
+	* timestamps are absolute, otherwise they are the time since boot.
+	* Returns number of written bytes.
+	*/
+	size_t dump(Print& print, uint32_t now = 0) const;
+
+private:
+	struct Record {
+		unsigned long time;
+		uint32_t src;
+		uint32_t dst;
+		uint16_t srcPort;
+		uint16_t dstPort;
+		uint16_t origLen;
+		uint16_t capLen;
+		Kind kind;
+		char data[SSDP_TRACE_SNAP_SIZE];
+	};
+
+	static size_t _dumpRecord(Print& print, const Record& record, unsigned long now_ms, uint32_t now);
+
+	Record _records[SSDP_TRACE_RECORDS];
+	Record* _current = nullptr;
+	uint8_t _next = 0;
+	uint8_t _recordsNum = 0;
+	uint32_t _overwrittenNum = 0;
+	size_t _written = 0;
+};
+
+#endif
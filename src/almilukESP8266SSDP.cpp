@@ -4,6 +4,12 @@
 
 #include <functional>
 #include "almilukESP8266SSDP.h"
+#include "SSDPPacket.h"
+#include "SSDPProxy.h"
+#include "SSDPDescriptionFetcher.h"
+#include "SSDPHTTPServer.h"
+#include "SSDPTrace.h"
+#include "SSDPSearchStats.h"
 #include "WiFiUdp.h"
 #include "debug.h"
 
@@ -21,14 +27,12 @@ extern "C" {
 #include "include/UdpContext.h"
 //#define DEBUG_SSDP Serial
 
-#define SSDP_PORT		 1900
 #define SSDP_METHOD_SIZE 10
 #define SSDP_URI_SIZE	 2
 #define SSDP_BUFFER_SIZE 64
-
-// ssdp ipv6 is FF05::C
-// lwip-v2's igmp_joingroup only supports IPv4
-#define SSDP_MULTICAST_ADDR 239, 255, 255, 250
+// Period of _update() calls in autorun mode (ms), it limits precision of response deadlines
+#define SSDP_TIMER_INTERVAL 100
+#define SSDP_SCPD_URL_TEMPLATE "ssdp/service%u.xml"
 
 static const char _ssdp_response_template[] PROGMEM =
 "HTTP/1.1 200 OK\r\n"
@@ -44,6 +48,15 @@ static const char _ssdp_notify_bb_template[] PROGMEM =
 "HOST: 239.255.255.250:1900\r\n"
 "NTS: ssdp:byebye\r\n";
 
+// Shared with SSDPProxy, so it isn't static
+extern const char _ssdp_search_template[] PROGMEM =
+"M-SEARCH * HTTP/1.1\r\n"
+"HOST: 239.255.255.250:1900\r\n"
+"MAN: \"ssdp:discover\"\r\n"
+"MX: %u\r\n"
+"ST: %s\r\n"
+"\r\n";
+
 static const char _ssdp_packet_template[] PROGMEM =
 "%s" // _ssdp_response_template / _ssdp_notify_template
 "CACHE-CONTROL: max-age=%u\r\n" // _interval
@@ -54,12 +67,14 @@ static const char _ssdp_packet_template[] PROGMEM =
 "BOOTID.UPNP.ORG: %d\r\n" // _bootId
 "CONFIGID.UPNP.ORG: %d\r\n"; // _configId
 
-static const char _ssdp_schema_template[] PROGMEM =
+static const char _ssdp_schema_header[] PROGMEM =
 "HTTP/1.1 200 OK\r\n"
 "Content-Type: text/xml\r\n"
 "Connection: close\r\n"
 "Access-Control-Allow-Origin: *\r\n"
-"\r\n"
+"\r\n";
+
+static const char _ssdp_schema_template[] PROGMEM =
 "<?xml version=\"1.0\"?>"
 "<root xmlns=\"urn:schemas-upnp-org:device-1-0\""
 "	configId=\"%d\">"
@@ -78,7 +93,18 @@ static const char _ssdp_schema_template[] PROGMEM =
 "<modelURL>%s</modelURL>"
 "<manufacturer>%s</manufacturer>"
 "<manufacturerURL>%s</manufacturerURL>"
-"<UDN>%s</UDN>"
+"<UDN>%s</UDN>";
+
+static const char _ssdp_schema_service_template[] PROGMEM =
+"<service>"
+"<serviceType>urn:%s</serviceType>"
+"<serviceId>urn:%.*s:serviceId:%.*s</serviceId>"
+"<SCPDURL>" SSDP_SCPD_URL_TEMPLATE "</SCPDURL>"
+"<controlURL></controlURL>"
+"<eventSubURL></eventSubURL>"
+"</service>";
+
+static const char _ssdp_schema_tail[] PROGMEM =
 "</device>"
 //"<iconList>"	
 //"<icon>"	
@@ -96,8 +122,7 @@ static const char _ssdp_schema_template[] PROGMEM =
 //"<url>icon120.png</url>"	 
 //"</icon>"	
 //"</iconList>"
-"</root>\r\n"
-"\r\n";
+"</root>\r\n";
 
 
 struct SSDPTimer {
@@ -125,6 +150,10 @@ SSDPClass::SSDPClass()
 SSDPClass::~SSDPClass() {
 	end();
 	_deleteServiceTypes();
+	setProxy(false);
+	setHTTPServer(false);
+	setTrace(false);
+	setSearchStats(false);
 }
 
 bool SSDPClass::begin() {
@@ -160,17 +189,34 @@ bool SSDPClass::begin() {
 		return false;
 	}
 
+	if (_proxy) {
+		IPAddress ap_addr = WiFi.softAPIP();
+		if (igmp_joingroup(ap_addr, mcast_addr) != ERR_OK) {
+		#ifdef DEBUG_SSDP
+				DEBUG_SSDP.printf_P(PSTR("SSDP failed to join igmp group on SoftAP\n"));
+		#endif
+			return false;
+		}
+	}
+
 	if (!_server->listen(IP_ADDR_ANY, SSDP_PORT)) {
 		return false;
 	}
 
 	_server->setMulticastInterface(local_addr);
 	_server->setMulticastTTL(_ttl);
-	_server->onRx(std::bind(&SSDPClass::_update, this));
+	_server->onRx(std::bind(&SSDPClass::_onRx, this));
 	if (!_server->connect(mcast_addr, SSDP_PORT)) {
 		return false;
 	}
 
+	if (_http && !_http->begin(_port)) {
+	#ifdef DEBUG_SSDP
+			DEBUG_SSDP.printf_P(PSTR("SSDP failed to start HTTP server\n"));
+	#endif
+		return false;
+	}
+
 	_startTimer();
 
 	return true;
@@ -189,6 +235,9 @@ void SSDPClass::end() {
 	// undo all initializations done in begin(), in reverse order
 	_stopTimer();
 
+	if (_http)
+		_http->end();
+
 	_server->disconnect();
 
 	IPAddress local_addr = WiFi.localIP();
@@ -200,8 +249,23 @@ void SSDPClass::end() {
 	#endif
 	}
 
+	if (_proxy) {
+		_proxy->clear();
+		if (igmp_leavegroup(WiFi.softAPIP(), mcast_addr) != ERR_OK) {
+		#ifdef DEBUG_SSDP
+				DEBUG_SSDP.printf_P(PSTR("SSDP failed to leave igmp group on SoftAP\n"));
+		#endif
+		}
+	}
+
 	_server->unref();
 	_server = 0;
+	_rxBacklog = 0;
+	_notifyIndex = -1;
+	// begin() starts in loop() mode again
+	_budgeted = false;
+	for (ResponseSchedule& schedule : _responses)
+		schedule.target = none;
 
 	#ifdef DEBUG_SSDP
 		DEBUG_SSDP.printf_P(PSTR("ok\n"));
@@ -244,7 +308,9 @@ void SSDPClass::_sendSSDPMessage(MessageType msg_type, const char* st_on_nt_val,
 	);
 
 	_sending = true;
-	_server->append(buffer, len);
+	if (_trace)
+		_trace->begin(SSDPTrace::TX);
+	_append(buffer, len);
 
 	IPAddress remoteAddr;
 	uint16_t remotePort;
@@ -266,16 +332,16 @@ void SSDPClass::_sendSSDPMessage(MessageType msg_type, const char* st_on_nt_val,
 				DEBUG_SSDP.println("Sending Notify to ");
 		#endif
 	}
-	_server->append("\r\n", 2);
+	_append("\r\n", 2);
 	_sending = false;
 	#ifdef DEBUG_SSDP
 		DEBUG_SSDP.print(IPAddress(remoteAddr));
 		DEBUG_SSDP.print(":");
 		DEBUG_SSDP.println(remotePort);
 		DEBUG_SSDP.print("Successfully sent: ");
-		DEBUG_SSDP.println(_server->send(remoteAddr, remotePort));
+		DEBUG_SSDP.println(_send(remoteAddr, remotePort));
 	#else
-		_server->send(remoteAddr, remotePort);
+		_send(remoteAddr, remotePort);
 	#endif
 }
 
@@ -292,12 +358,94 @@ void SSDPClass::_advertiseTarget(MessageType msg_type, int16_t target) {
 }
 
 void SSDPClass::_advertiseAll(MessageType msg_type) {
-	_advertiseTarget(msg_type, rootdevice);
-	_advertiseTarget(msg_type, uuid);
-	_advertiseTarget(msg_type, deviceType);
+	for (uint16_t i = 0; i < _targetsNum(); i++)
+		_advertiseTarget(msg_type, _targetAt(i));
+}
+
+int16_t SSDPClass::_targetAt(uint16_t index) const {
+	switch (index) {
+	case 0:
+		return rootdevice;
+	case 1:
+		return uuid;
+	case 2:
+		return deviceType;
+	default:
+		return (index < _targetsNum()) ? index - 3 : none;
+	}
+}
+
+bool SSDPClass::_scheduleResponses(int target, uint16_t mx, const IPAddress& addr, uint16_t port) {
+	ResponseSchedule* schedule = _freeSchedule();
+	if (!schedule)
+		return false;
+
+	if (mx > SSDP_MAX_MX)
+		mx = SSDP_MAX_MX;
+
+	schedule->target = target;
+	schedule->addr = addr;
+	schedule->port = port;
+	schedule->start = millis();
+	schedule->total = (target == all) ? _targetsNum() : 1;
+	schedule->sent = 0;
+	schedule->slot = mx * 1000UL / schedule->total;
+	schedule->deadline = random(0, schedule->slot);
+	return true;
+}
+
+SSDPClass::ResponseSchedule* SSDPClass::_freeSchedule() {
+	for (ResponseSchedule& schedule : _responses)
+		if (schedule.target == none)
+			return &schedule;
+	return nullptr;
+}
+
+SSDPClass::ResponseSchedule* SSDPClass::_findSchedule(int target, const IPAddress& addr, uint16_t port) {
+	for (ResponseSchedule& schedule : _responses)
+		if (schedule.target == target && schedule.port == port && schedule.addr == addr)
+			return &schedule;
+	return nullptr;
+}
+
+bool SSDPClass::_isResponding() const {
+	for (const ResponseSchedule& schedule : _responses)
+		if (schedule.target != none)
+			return true;
+	return false;
+}
+
+void SSDPClass::_sendDueResponses() {
+	while (_sendDueResponse());
+}
 
-	for (int16_t i = 0; i < _servicesNum; i++)
-		_advertiseTarget(msg_type, i);
+bool SSDPClass::_sendDueResponse() {
+	// The most overdue response first
+	unsigned long now = millis();
+	ResponseSchedule* due = nullptr;
+	for (ResponseSchedule& schedule : _responses) {
+		if (schedule.target == none || now - schedule.start < schedule.deadline)
+			continue;
+		if (!due || (now - schedule.start) - schedule.deadline > (now - due->start) - due->deadline)
+			due = &schedule;
+	}
+	if (!due)
+		return false;
+
+	int16_t target = (due->target == all) ? _targetAt(due->sent) : due->target;
+	if (target != none) {
+		_advertisement_target = due->target;
+		_addrForResponse = due->addr;
+		_portForResponse = due->port;
+		_advertiseTarget(RESPONSE, target);
+		_advertisement_target = none;
+	}
+
+	if (++due->sent >= due->total)
+		due->target = none;
+	else
+		due->deadline = due->sent * due->slot + random(0, due->slot);
+	return true;
 }
 
 void SSDPClass::_getTargetUsnHeader(int16_t target, const char* st_or_nt_val, char* buffer, int16_t buffer_size) {
@@ -329,6 +477,14 @@ void SSDPClass::_getTargetStOrNtHeader(int16_t target, char buffer[], int16_t bu
 }
 
 void SSDPClass::schema(Print& client) const {
+	char header[strlen_P(_ssdp_schema_header) + 1];
+	strcpy_P(header, _ssdp_schema_header);
+	client.print(header);
+	_printSchemaBody(client);
+	client.print("\r\n");
+}
+
+void SSDPClass::_printSchemaBody(Print& client) const {
 	IPAddress ip = WiFi.localIP();
 	char buffer[strlen_P(_ssdp_schema_template) + 1];
 	strcpy_P(buffer, _ssdp_schema_template);
@@ -346,215 +502,450 @@ void SSDPClass::schema(Print& client) const {
 		_manufacturerURL,
 		_uuid
 	);
+
+	// Only services with SCPD served by the built-in server are listed
+	if (_http && _servicesNum > 0) {
+		char service_buffer[strlen_P(_ssdp_schema_service_template) + 1];
+		strcpy_P(service_buffer, _ssdp_schema_service_template);
+		bool listed = false;
+		for (int i = 0; i < _servicesNum; i++) {
+			char url[SSDP_SCHEMA_URL_SIZE];
+			snprintf_P(url, sizeof(url), PSTR(SSDP_SCPD_URL_TEMPLATE), i);
+			if (!_http->hasDocument(url))
+				continue;
+
+			// Service types are stored as "<domain>:service:<name>:<version>"
+			const char* type = _serviceTypes[i];
+			const char* kind = strstr(type, ":service:");
+			if (!kind)
+				continue;
+			if (!listed) {
+				client.print("<serviceList>");
+				listed = true;
+			}
+			const char* name = kind + strlen(":service:");
+			const char* version = strchr(name, ':');
+			client.printf(service_buffer,
+				type,
+				(int)(kind - type), type,
+				version ? (int)(version - name) : (int)strlen(name), name,
+				i
+			);
+		}
+		if (listed)
+			client.print("</serviceList>");
+	}
+
+	char tail[strlen_P(_ssdp_schema_tail) + 1];
+	strcpy_P(tail, _ssdp_schema_tail);
+	client.print(tail);
 }
 
-void SSDPClass::_update() {
-	if (_advertisement_target == none && _server->next()) {
-		_addrForResponse = _server->getRemoteAddress();
-		_portForResponse = _server->getRemotePort();
+bool SSDPClass::_parsePacket(SSDPPacket& packet) {
+	packet.remoteAddr = _server->getRemoteAddress();
+	packet.remotePort = _server->getRemotePort();
+
+	typedef enum { METHOD, URI, PROTO, KEY, VALUE, ABORT } states;
+	states state = METHOD;
+
+	typedef enum { START, MAN, MX, CACHE_CONTROL, CONFIG_ID, STORED } headers;
+	headers header = START;
+
+	uint16_t cursor = 0;
+	uint8_t cr = 0;
+
+	if (_trace)
+		_trace->begin(SSDPTrace::RX, _server->getSize());
+
+	char buffer[SSDP_BUFFER_SIZE] = { 0 };
+	// Destination of the current header value: buffer or a field of the packet
+	char* value = buffer;
+	uint16_t value_size = sizeof(buffer);
+
+	while (_server->getSize() > 0 && state != ABORT) {
+		char c = _server->read();
+		if (_trace)
+			_trace->append(c);
+
+		(c == '\r' || c == '\n') ? cr++ : cr = 0;
+
+		switch (state) {
+		case METHOD:
+			if (c == ' ') {
+				if (strcmp(buffer, "M-SEARCH") == 0)
+					packet.method = SSDPPacket::SEARCH;
+				else if (_acceptsAnnouncements() && strcmp(buffer, "NOTIFY") == 0)
+					packet.method = SSDPPacket::NOTIFY;
+				else if (_acceptsAnnouncements() && strcmp(buffer, "HTTP/1.1") == 0)
+					packet.method = SSDPPacket::RESPONSE;
+
+				if (packet.method == SSDPPacket::UNKNOWN)
+					state = ABORT;
+				else if (packet.method == SSDPPacket::RESPONSE)
+					state = PROTO; // status code and reason aren't interesting
+				else
+					state = URI;
+				cursor = 0;
+
+			} else if (cursor < SSDP_METHOD_SIZE - 1) {
+				buffer[cursor++] = c;
+				buffer[cursor] = '\0';
+			}
+			break;
+		case URI:
+			if (c == ' ') {
+				if (strcmp(buffer, "*")) state = ABORT;
+				else state = PROTO;
+				cursor = 0;
+			} else if (cursor < SSDP_URI_SIZE - 1) {
+				buffer[cursor++] = c;
+				buffer[cursor] = '\0';
+			}
+			break;
+		case PROTO:
+			if (cr == 2) {
+				state = KEY;
+				cursor = 0;
+				buffer[0] = '\0';
+			}
+			break;
+		case KEY:
+			if (cr == 2) {
+				// line without colon, skip it
+				cursor = 0;
+				buffer[0] = '\0';
+			} else if (c == ':') {
+				value = buffer;
+				value_size = sizeof(buffer);
+				header = STORED;
+				if (!strcasecmp(buffer, "ST") || !strcasecmp(buffer, "NT")) {
+					value = packet.target;
+					value_size = sizeof(packet.target);
+				} else if (!strcasecmp(buffer, "USN")) {
+					value = packet.usn;
+					value_size = sizeof(packet.usn);
+				} else if (!strcasecmp(buffer, "NTS")) {
+					value = packet.nts;
+					value_size = sizeof(packet.nts);
+				} else if (!strcasecmp(buffer, "LOCATION")) {
+					value = packet.location;
+					value_size = sizeof(packet.location);
+				} else if (!strcasecmp(buffer, "SERVER")) {
+					value = packet.server;
+					value_size = sizeof(packet.server);
+				} else if (!strcasecmp(buffer, "USER-AGENT")) {
+					value = packet.userAgent;
+					value_size = sizeof(packet.userAgent);
+				} else if (!strcasecmp(buffer, "MAN")) {
+					header = MAN;
+				} else if (!strcasecmp(buffer, "MX")) {
+					header = MX;
+				} else if (!strcasecmp(buffer, "CACHE-CONTROL")) {
+					header = CACHE_CONTROL;
+				} else if (!strcasecmp(buffer, "CONFIGID.UPNP.ORG")) {
+					header = CONFIG_ID;
+				} else {
+					header = START;
+				}
+				state = VALUE;
+				cursor = 0;
+				value[0] = '\0';
+			} else if (c != '\r' && c != '\n' && cursor < SSDP_BUFFER_SIZE - 1) {
+				buffer[cursor++] = c;
+				buffer[cursor] = '\0';
+			}
+			break;
+		case VALUE:
+			if (cr == 2) {
+				switch (header) {
+				case MAN:
+					#ifdef DEBUG_SSDP
+						DEBUG_SSDP.printf("MAN: %s\n", (char*)buffer);
+					#endif
+					break;
+				case MX:
+					packet.mx = atoi(buffer);
+					break;
+				case CACHE_CONTROL:
+					if (strchr(buffer, '='))
+						packet.maxAge = atol(strchr(buffer, '=') + 1);
+					break;
+				case CONFIG_ID:
+					packet.configId = atol(buffer);
+					break;
+				default:
+					break;
+				}
 
-		typedef enum { METHOD, URI, PROTO, KEY, VALUE, ABORT } states;
-		states state = METHOD;
+				state = KEY;
+				header = START;
+				cursor = 0;
+				buffer[0] = '\0';
+			} else if (c != '\r' && c != '\n' && (cursor > 0 || (c != ' ' && c != '\t'))) {
+				if (cursor < value_size - 1) {
+					value[cursor++] = c;
+					value[cursor] = '\0';
+				}
+			}
+			break;
+		case ABORT:
+			break;
+		}
+	}
 
-		typedef enum { START, MAN, ST, MX } headers;
-		headers header = START;
+	if (_trace) {
+		// Rest of rejected datagram is dropped anyway
+		while (_server->getSize() > 0 && !_trace->isFull())
+			_trace->append((char)_server->read());
+		_trace->commit(packet.remoteAddr, packet.remotePort, _server->getDestAddress(), SSDP_PORT);
+	}
 
-		uint8_t cursor = 0;
-		uint8_t cr = 0;
+	return state != ABORT;
+}
 
-		char buffer[SSDP_BUFFER_SIZE] = { 0 };
+int SSDPClass::_matchTarget(const char* st) {
+	int len = strlen(st);
+
+	if (!strcasecmp(st, "ssdp:all"))
+		return all;
+	if (!strcasecmp(st, "upnp:rootdevice"))
+		return rootdevice;
+	if (len > 4 && !strcasecmp(st + 4, _deviceType))
+		return deviceType;
+	if (len > 5 && !strcasecmp(st + 5, _uuid))
+		return uuid;
+	if (len > 4) {
+		for (int i = 0; i < _servicesNum; i++)
+			if (!strcasecmp(st + 4, _serviceTypes[i]))
+				return i;
+	}
+	return none;
+}
 
-		int len = 0;
+void SSDPClass::_processPacket() {
+	SSDPPacket packet;
+	if (!_parsePacket(packet)) {
+		if (_trace)
+			_trace->mark(packet.method == SSDPPacket::UNKNOWN ? PSTR("reject method") : PSTR("reject uri"));
+		return;
+	}
 
-		while (_server->getSize() > 0) {
-			char c = _server->read();
+	if (_trace) {
+		if (packet.method == SSDPPacket::NOTIFY)
+			_trace->mark(PSTR("accept notify NT=%s NTS=%s"), packet.target, packet.nts);
+		else if (packet.method == SSDPPacket::RESPONSE)
+			_trace->mark(PSTR("accept response ST=%s"), packet.target);
+	}
 
-			(c == '\r' || c == '\n') ? cr++ : cr = 0;
+	if (_proxy)
+		_proxy->handlePacket(packet);
 
-			switch (state) {
-			case METHOD:
-				if (c == ' ') {
-					if (strcmp(buffer, "M-SEARCH") == 0) 
-						state = URI;
-					else
-						state = ABORT;
-					cursor = 0;
+	if (_fetcher && packet.location[0] && (packet.method == SSDPPacket::RESPONSE
+		|| (packet.method == SSDPPacket::NOTIFY && !strcasecmp(packet.nts, "ssdp:alive"))))
+		_fetcher->fetch(packet.location, packet.configId);
 
-				} else if (cursor < SSDP_METHOD_SIZE - 1) {
-					buffer[cursor++] = c;
-					buffer[cursor] = '\0';
-				}
-				break;
-			case URI:
-				if (c == ' ') {
-					if (strcmp(buffer, "*")) state = ABORT;
-					else state = PROTO;
-					cursor = 0;
-				} else if (cursor < SSDP_URI_SIZE - 1) {
-					buffer[cursor++] = c;
-					buffer[cursor] = '\0';
-				}
-				break;
-			case PROTO:
-				if (cr == 2) {
-					state = KEY;
-					cursor = 0;
-				}
-				break;
-			case KEY:
-				if (cr == 4) {
-					_process_time = millis();
-				} else if (c == ' ') {
-					cursor = 0;
-					state = VALUE;
-				} else if (c != '\r' && c != '\n' && c != ':' && cursor < SSDP_BUFFER_SIZE - 1) {
-					buffer[cursor++] = c;
-					buffer[cursor] = '\0';
-				}
-				break;
-			case VALUE:
-				if (cr == 2) {
-					switch (header) {
-					case START:
-						break;
-					case MAN:
-						#ifdef DEBUG_SSDP
-							DEBUG_SSDP.printf("MAN: %s\n", (char*)buffer);
-						#endif
-						break;
-					case ST:
-						_process_time = millis();
-						state = KEY;
-						len = strlen(buffer);
-
-						if (!strcasecmp(buffer, "ssdp:all")) {
-							_advertisement_target = all;
-						} else if (!strcasecmp(buffer, "upnp:rootdevice")) {
-							_advertisement_target = rootdevice;
-						} else if (len > 4 && !strcasecmp(buffer + 4, _deviceType)) {
-							_advertisement_target = deviceType;
-						} else if (len > 5 && !strcasecmp(buffer + 5, _uuid)) {
-							_advertisement_target = uuid;
-						} else if (len > 4) {
-							for (int i = 0; i < _servicesNum; i++) {
-								if (!strcasecmp(buffer + 4, _serviceTypes[i])) {
-									_advertisement_target = i;
-									break;
-								}
-							}
-						}
-
-						if (_advertisement_target == none) {
-							state = ABORT;
-							#ifdef DEBUG_SSDP
-								DEBUG_SSDP.printf("REJECT: %s\n", (char*)buffer);
-							#endif
-						}
-						break;
-					case MX:
-						_delay = random(0, atoi(buffer)) * 1000L;
-						break;
-					}
-
-					if (state != ABORT) {
-						state = KEY;
-						header = START;
-						cursor = 0;
-					}
-				} else if (c != '\r' && c != '\n') {
-					if (header == START) {
-						if (strncmp(buffer, "MA", 2) == 0) header = MAN;
-						else if (strcmp(buffer, "ST") == 0) header = ST;
-						else if (strcmp(buffer, "MX") == 0) header = MX;
-					}
-
-					if (cursor < SSDP_BUFFER_SIZE - 1) {
-						buffer[cursor++] = c;
-						buffer[cursor] = '\0';
-					}
-				}
-				break;
-			case ABORT:
-				_delay = 0;
-				_advertisement_target = none;
-				break;
-			}
-		}
+	if (packet.method != SSDPPacket::SEARCH)
+		return;
+
+	if (_stats)
+		_stats->record(packet);
+
+	int target = _matchTarget(packet.target);
+	if (target == none) {
+		#ifdef DEBUG_SSDP
+			DEBUG_SSDP.printf("REJECT: %s\n", packet.target);
+		#endif
+		if (_trace)
+			_trace->mark(PSTR("reject target ST=%s"), packet.target);
+		return;
 	}
 
-	if (_advertisement_target != none && (millis() - _process_time) > _delay) {
-		if (_advertisement_target == all) {
-			_advertiseAll(RESPONSE);
-		} else {
-			_advertiseTarget(RESPONSE, _advertisement_target);
-		}
-		_delay = 0;
-		_advertisement_target = none;
-	} else if (_notify_time == 0 || (millis() - _notify_time) > (_interval * 1000L)) {
+	// Repeated request (control points send a few copies) is being answered already
+	if (_findSchedule(target, packet.remoteAddr, packet.remotePort)) {
+		if (_trace)
+			_trace->mark(PSTR("reject duplicate ST=%s"), packet.target);
+		return;
+	}
+
+	if (!_scheduleResponses(target, packet.mx, packet.remoteAddr, packet.remotePort)) {
+		if (_trace)
+			_trace->mark(PSTR("reject busy ST=%s"), packet.target);
+		return;
+	}
+
+	if (_trace)
+		_trace->mark(PSTR("accept search ST=%s MX=%u"), packet.target, packet.mx);
+}
+
+void SSDPClass::_update() {
+	// Proxy and fetcher must see all packets, so they are processed even if all schedules are in use
+	if ((_freeSchedule() || _acceptsAnnouncements()) && _nextPacket())
+		_processPacket();
+
+	if (_proxy)
+		while (_proxy->sendNext(_server));
+
+	// Burst begun by loop(budget_us) is finished at once
+	if (_notifyIndex >= 0) {
+		while (_notifyIndex < _targetsNum())
+			_advertiseTarget(NOTIFY_ALIVE, _targetAt(_notifyIndex++));
+		_notifyIndex = -1;
+	}
+
+	if (_isResponding()) {
+		_sendDueResponses();
+	} else if (_isNotifyDue()) {
 		// Send NOTIFY_ALIVE messages about all every <_interval> seconds.
 		_notify_time = millis();
 		_advertiseAll(NOTIFY_ALIVE);
 	}
 
-	// If get new request while previous isn't answered already, ignore it.
-	if (_advertisement_target != none) {
-		while (_server->next())
-			_server->flush();
+	// If get new request while SSDP_RESPONSE_SCHEDULES previous ones aren't answered already, ignore it.
+	if (!_freeSchedule() && !_acceptsAnnouncements()) {
+		while (_nextPacket())
+			_dropPacket();
 	}
 
 }
 
+void SSDPClass::_dropPacket() {
+	// Not answered, but still counted and traced
+	if (_stats || _trace) {
+		SSDPPacket packet;
+		bool parsed = _parsePacket(packet);
+		if (_stats && parsed)
+			_stats->record(packet);
+
+		if (_trace) {
+			if (!parsed)
+				_trace->mark(packet.method == SSDPPacket::UNKNOWN ? PSTR("reject method") : PSTR("reject uri"));
+			else
+				_trace->mark(PSTR("reject busy ST=%s"), packet.target);
+		}
+	}
+	_server->flush();
+}
+
+void SSDPClass::_onRx() {
+	if (_budgeted)
+		_rxBacklog++;
+	else
+		_update();
+}
+
+bool SSDPClass::_step() {
+	// Datagrams queued by the proxy for the last packet go before the next packet is taken
+	if (_proxy && _proxy->sendNext(_server))
+		return true;
+
+	// The same order as in _update()
+	if (_freeSchedule() || _acceptsAnnouncements()) {
+		if (_nextPacket()) {
+			_processPacket();
+			return true;
+		}
+	} else if (_nextPacket()) {
+		// If get new request while SSDP_RESPONSE_SCHEDULES previous ones aren't answered already, ignore it.
+		_dropPacket();
+		return true;
+	}
+
+	if (_sendDueResponse())
+		return true;
+
+	// Burst of NOTIFY messages is sent one message per step
+	if (_notifyIndex < 0 && !_isResponding() && _isNotifyDue()) {
+		_notify_time = millis();
+		_notifyIndex = 0;
+	}
+	if (_notifyIndex >= 0) {
+		if (_notifyIndex < _targetsNum())
+			_advertiseTarget(NOTIFY_ALIVE, _targetAt(_notifyIndex++));
+		if (_notifyIndex >= _targetsNum())
+			_notifyIndex = -1;
+		return true;
+	}
+
+	return false;
+}
+
+bool SSDPClass::_nextPacket() {
+	if (!_server->next()) {
+		_rxBacklog = 0;
+		return false;
+	}
+	if (_rxBacklog > 0)
+		_rxBacklog--;
+	return true;
+}
+
+bool SSDPClass::_isNotifyDue() const {
+	return _notify_time == 0 || (millis() - _notify_time) > (_interval * 1000L);
+}
+
 void SSDPClass::setSchemaURL(const char* url) {
 	strlcpy(_schemaURL, url, sizeof(_schemaURL));
 }
 
 void SSDPClass::setHTTPPort(uint16_t port) {
 	_port = port;
+	_invalidateSchema();
 }
 
 void SSDPClass::setDeviceType(const char *domain, const char* deviceType, const char* version) {
 	snprintf_P(_deviceType, sizeof(_deviceType), "%s:device:%s:%s", 
 				domain, deviceType, version);
+	_invalidateSchema();
 }
 
 void SSDPClass::setUUID(const char* uuid) {
 	strlcpy(_uuid, uuid, sizeof(_uuid));
+	_invalidateSchema();
 }
 
 void SSDPClass::setName(const char* name) {
 	strlcpy(_friendlyName, name, sizeof(_friendlyName));
+	_invalidateSchema();
 }
 
 void SSDPClass::setURL(const char* url) {
 	strlcpy(_presentationURL, url, sizeof(_presentationURL));
+	_invalidateSchema();
 }
 
 void SSDPClass::setSerialNumber(const char* serialNumber) {
 	strlcpy(_serialNumber, serialNumber, sizeof(_serialNumber));
+	_invalidateSchema();
 }
 
 void SSDPClass::setSerialNumber(const uint32_t serialNumber) {
 	snprintf(_serialNumber, sizeof(uint32_t) * 2 + 1, "%08X", serialNumber);
+	_invalidateSchema();
 }
 
 void SSDPClass::setModelName(const char* name) {
 	strlcpy(_modelName, name, sizeof(_modelName));
+	_invalidateSchema();
 }
 
 void SSDPClass::setModelNumber(const char* num) {
 	strlcpy(_modelNumber, num, sizeof(_modelNumber));
+	_invalidateSchema();
 }
 
 void SSDPClass::setModelURL(const char* url) {
 	strlcpy(_modelURL, url, sizeof(_modelURL));
+	_invalidateSchema();
 }
 
 void SSDPClass::setManufacturer(const char* name) {
 	strlcpy(_manufacturer, name, sizeof(_manufacturer));
+	_invalidateSchema();
 }
 
 void SSDPClass::setManufacturerURL(const char* url) {
 	strlcpy(_manufacturerURL, url, sizeof(_manufacturerURL));
+	_invalidateSchema();
 }
 
 void SSDPClass::setBootId(int boot_id) {
@@ -565,6 +956,7 @@ void SSDPClass::setBootId(int boot_id) {
 void SSDPClass::setConfigId(int config_id) {
 	if (config_id >= 0)
 		_configId = config_id;
+	_invalidateSchema();
 }
 
 void SSDPClass::setServiceTypes(SSDPServiceType types[], uint8_t services_num) {
@@ -576,6 +968,7 @@ void SSDPClass::setServiceTypes(SSDPServiceType types[], uint8_t services_num) {
 					types[i].domain, types[i].service, types[i].version);
 	}
 	_servicesNum = services_num;
+	_invalidateSchema();
 }
 
 void SSDPClass::setTTL(const uint8_t ttl) {
@@ -590,9 +983,123 @@ void SSDPClass::setAutorun(bool flag) {
 	_auto_mode = flag;
 }
 
+void SSDPClass::setProxy(bool flag) {
+	if (flag && !_proxy) {
+		_proxy = new SSDPProxy();
+		_proxy->setTrace(_trace);
+	} else if (!flag && _proxy) {
+		delete _proxy;
+		_proxy = nullptr;
+	}
+}
+
+void SSDPClass::setHTTPServer(bool flag) {
+	if (flag && !_http) {
+		_http = new SSDPHTTPServer(_schemaURL, [this](Print& print) { _printSchemaBody(print); });
+	} else if (!flag && _http) {
+		delete _http;
+		_http = nullptr;
+	}
+}
+
+bool SSDPClass::setServiceSCPD(uint8_t service, const char* body, size_t len, const uint8_t* gzip_body, size_t gzip_len) {
+	if (!_http || service >= _servicesNum)
+		return false;
+
+	char url[SSDP_SCHEMA_URL_SIZE];
+	snprintf_P(url, sizeof(url), PSTR(SSDP_SCPD_URL_TEMPLATE), service);
+	if (!_http->addDocument(url, body, len, gzip_body, gzip_len))
+		return false;
+
+	// The service appears in serviceList of the schema
+	_invalidateSchema();
+	return true;
+}
+
+void SSDPClass::setTrace(bool flag) {
+	if (flag && !_trace) {
+		_trace = new SSDPTrace();
+		if (_proxy)
+			_proxy->setTrace(_trace);
+	} else if (!flag && _trace) {
+		if (_proxy)
+			_proxy->setTrace(nullptr);
+		delete _trace;
+		_trace = nullptr;
+	}
+}
+
+void SSDPClass::setSearchStats(bool flag) {
+	if (flag && !_stats) {
+		_stats = new SSDPSearchStats();
+	} else if (!flag && _stats) {
+		delete _stats;
+		_stats = nullptr;
+	}
+}
+
+void SSDPClass::_append(const char* data, size_t len) {
+	if (_trace)
+		_trace->append(data, len);
+	_server->append(data, len);
+}
+
+bool SSDPClass::_send(const IPAddress& addr, uint16_t port) {
+	if (_trace)
+		_trace->commit(WiFi.localIP(), SSDP_PORT, addr, port);
+	return _server->send(addr, port);
+}
+
+void SSDPClass::_invalidateSchema() {
+	if (_http)
+		_http->invalidateSchema();
+}
+
+void SSDPClass::search(const char* st, uint8_t mx) {
+	if (!_server)
+		return;
+
+	char buffer[SSDP_ST_VAL_SIZE + 100];
+	int len = snprintf_P(buffer, sizeof(buffer), _ssdp_search_template, mx, st);
+	if (len <= 0 || len >= (int)sizeof(buffer))
+		return;
+
+	if (_trace)
+		_trace->begin(SSDPTrace::TX);
+	_append(buffer, len);
+	_send(IPAddress(SSDP_MULTICAST_ADDR), SSDP_PORT);
+}
+
 void SSDPClass::loop() {
-	if (_server)
-		_update();
+	if (!_server)
+		return;
+
+	// Datagrams are handled in lwIP callback again
+	_budgeted = false;
+	_update();
+}
+
+void SSDPClass::loop(uint32_t budget_us) {
+	if (!_server)
+		return;
+
+	_budgeted = true;
+	unsigned long start = micros();
+	while (_step() && micros() - start < budget_us);
+}
+
+uint16_t SSDPClass::getBacklog() const {
+	uint16_t backlog = _rxBacklog;
+	if (_proxy)
+		backlog += _proxy->getQueuedNum();
+	for (const ResponseSchedule& schedule : _responses)
+		if (schedule.target != none)
+			backlog += schedule.total - schedule.sent;
+	if (_notifyIndex >= 0)
+		backlog += _targetsNum() - _notifyIndex;
+	else if (!_isResponding() && _server && _isNotifyDue())
+		backlog += _targetsNum();
+	return backlog;
 }
 
 void SSDPClass::_onTimerStatic(SSDPClass* self) {
@@ -624,14 +1131,14 @@ void SSDPClass::addHeader(const char* header, const char* value) {
 	int len = strlen(header) + strlen(value) + 5;
 	char buffer[len];
 	snprintf(buffer, sizeof(buffer), "%s: %s\r\n", header, value);
-	_server->append(buffer, len);
+	_append(buffer, len);
 }
 
 void SSDPClass::_startTimer() {
 	_stopTimer();
 	_timer = new SSDPTimer();
 	ETSTimer* tm = &(_timer->timer);
-	const int interval = 1000;
+	const int interval = SSDP_TIMER_INTERVAL;
 	os_timer_disarm(tm);
 	os_timer_setfn(tm, reinterpret_cast<ETSTimerFunc*>(&SSDPClass::_onTimerStatic), reinterpret_cast<void*>(this));
 	os_timer_arm(tm, interval, 1 /* repeat */);
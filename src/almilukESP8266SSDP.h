@@ -25,9 +25,17 @@ class UdpContext;
 #define SSDP_INTERVAL_SECONDS		1200
 #define SSDP_MULTICAST_TTL			5
 #define SSDP_HTTP_PORT				80
+// Number of search requests answered at once, requests above it are dropped
+#define SSDP_RESPONSE_SCHEDULES		4
 
 
 struct SSDPTimer;
+struct SSDPPacket;
+class SSDPProxy;
+class SSDPDescriptionFetcher;
+class SSDPHTTPServer;
+class SSDPTrace;
+class SSDPSearchStats;
 
 class SSDPClass {
 public:
@@ -107,7 +115,56 @@ public:
 	*/
 	void setAutorun(bool flag);
 
+	/* If true, the device also works as caching SSDP proxy for SoftAP clients (WiFi must be in WIFI_AP_STA mode).
+	* Their searches are answered from the cache of devices announced in upstream network, only cache misses
+	* are forwarded (see SSDPProxy.h). SoftAP clients need NAPT to reach the devices (see examples/proxy).
+	* You must call the method before begin(). It is false by default.
+	*/
+	void setProxy(bool flag);
+
+	/* Received announcements and search responses are passed to the fetcher,
+	* so it fetches description documents of new and changed devices (see SSDPDescriptionFetcher.h).
+	* Pass nullptr to stop it. The fetcher is not owned by this object.
+	*/
+	void setFetcher(SSDPDescriptionFetcher* fetcher) { _fetcher = fetcher; }
+	// Sends M-SEARCH request (as control point), responses are passed to the fetcher if it is set.
+	void search(const char* st, uint8_t mx = 3);
+
+	/* If true, description document (at schema URL) and SCPD documents of services are served
+	* by built-in non-blocking HTTP server on HTTP port (see SSDPHTTPServer.h), so no separate web server is needed for them.
+	* You must call the method before begin(). It is false by default.
+	*/
+	void setHTTPServer(bool flag);
+	/* Sets SCPD document of the service with index <service> in array passed to setServiceTypes(),
+	* it is served by built-in HTTP server at "ssdp/service<service>.xml". body must stay valid (it may be in PROGMEM).
+	* gzip_body is optional gzip-compressed copy of body, it is sent to clients accepting gzip.
+	* You must call the method after setHTTPServer(true) and setServiceTypes().
+	*/
+	bool setServiceSCPD(uint8_t service, const char* body, size_t len, const uint8_t* gzip_body = nullptr, size_t gzip_len = 0);
+
+	/* If true, received and sent datagrams and parse decisions are recorded to in-RAM ring
+	* (about SSDP_TRACE_RECORDS * SSDP_TRACE_SNAP_SIZE bytes), see SSDPTrace.h. It is false by default.
+	*/
+	void setTrace(bool flag);
+	// nullptr if trace is disabled. Use getTrace()->dump(Serial) to get pcap file.
+	SSDPTrace* getTrace() { return _trace; }
+
+	/* If true, most frequent ST values, requesters and User-Agents of received searches are counted
+	* in fixed memory (see SSDPSearchStats.h). It is false by default.
+	*/
+	void setSearchStats(bool flag);
+	// nullptr if statistics are disabled. Print it with Serial.print(*SSDP.getSearchStats()), clear it with reset().
+	SSDPSearchStats* getSearchStats() { return _stats; }
+
 	void loop();
+	/* Does the work in small steps (one datagram parsed or one message sent) until budget_us microseconds are spent,
+	* the rest is continued on the next call. At least one step is done per call.
+	* After the call received datagrams are only queued in lwIP callback until loop() is called, so call it regularly
+	* and don't use it with autorun. loop() finishes the work left by it.
+	*/
+	void loop(uint32_t budget_us);
+	// Number of steps waiting for loop(budget_us): received datagrams, due responses and NOTIFY messages
+	uint16_t getBacklog() const;
 
 protected:
 	// if >= 0, it is index of service in _serviceTypes array
@@ -128,20 +185,66 @@ private:
 		NOTIFY_BB
 	};
 
+	// Responses to a search request are spread evenly over its MX window:
+	// i-th response is sent at random moment of i-th of <total> equal parts of the window.
+	struct ResponseSchedule {
+		int target = none;			// none if the schedule is free
+		IPAddress addr;				// of the requester
+		uint16_t port = 0;
+		unsigned long start = 0;	// reception time of the request
+		uint32_t slot = 0;			// length of the window part (ms)
+		uint32_t deadline = 0;		// of the next response, relative to start (ms)
+		uint16_t total = 0;
+		uint16_t sent = 0;
+	};
+
 	void _sendSSDPMessage(MessageType msg_type, const char* st_on_nt_val, const char* usn);
 	void _sendNotificationMessage(const char* nt_header, const char* usn_header);
 	void _advertiseTarget(MessageType msg_type, int16_t target);
 	void _advertiseAll(MessageType msg_type);
+	// rootdevice, uuid, deviceType and then services
+	int16_t _targetAt(uint16_t index) const;
+	uint16_t _targetsNum() const { return _servicesNum + 3; }
+	// Returns false if all schedules are in use
+	bool _scheduleResponses(int target, uint16_t mx, const IPAddress& addr, uint16_t port);
+	ResponseSchedule* _freeSchedule();
+	ResponseSchedule* _findSchedule(int target, const IPAddress& addr, uint16_t port);
+	bool _isResponding() const;
+	void _sendDueResponses();
+	// Sends the next response if it is due, returns false if nothing is sent
+	bool _sendDueResponse();
+	bool _isNotifyDue() const;
 	void _getTargetUsnHeader(int16_t target, const char* st_or_nt_val, char* buffer, int16_t buffer_size);
 	void _getTargetStOrNtHeader(int16_t target, char* buffer, int16_t buffer_size);
 	void _update();
+	void _onRx();
+	// One step of loop(budget_us), returns false if there is nothing to do now
+	bool _step();
+	// Moves the socket to the next received datagram
+	bool _nextPacket();
+	void _processPacket();
+	// Takes the datagram which can't be answered from the socket, it is parsed only for statistics and trace
+	void _dropPacket();
+	// Send buffer of the socket with the trace
+	void _append(const char* data, size_t len);
+	bool _send(const IPAddress& addr, uint16_t port);
+	bool _parsePacket(SSDPPacket& packet);
+	int _matchTarget(const char* st);
+	bool _acceptsAnnouncements() const { return _proxy || _fetcher; }
 	void _startTimer();
 	void _stopTimer();
 	static void _onTimerStatic(SSDPClass* self);
 	void _deleteServiceTypes();
+	void _printSchemaBody(Print& print) const;
+	void _invalidateSchema();
 
 	UdpContext* _server = nullptr;
 	SSDPTimer* _timer = nullptr;
+	SSDPProxy* _proxy = nullptr;
+	SSDPDescriptionFetcher* _fetcher = nullptr;
+	SSDPHTTPServer* _http = nullptr;
+	SSDPTrace* _trace = nullptr;
+	SSDPSearchStats* _stats = nullptr;
 	uint16_t _port = SSDP_HTTP_PORT;
 	uint8_t _ttl = SSDP_MULTICAST_TTL;
 	uint32_t _interval = SSDP_INTERVAL_SECONDS;
@@ -150,12 +253,19 @@ private:
 	IPAddress _addrForResponse;
 	uint16_t  _portForResponse = 0;
 
+	// Target of the message being sent (for on_response() and others)
 	int _advertisement_target = none;
-	unsigned short _delay = 0;
-	unsigned long _process_time = 0;
+	ResponseSchedule _responses[SSDP_RESPONSE_SCHEDULES];
 	unsigned long _notify_time = 0;
 	bool _sending = false;
 
+	// Cooperative mode (loop(budget_us))
+	bool _budgeted = false;
+	// Datagrams received but not taken from the socket
+	uint16_t _rxBacklog = 0;
+	// Index of the next NOTIFY of the current burst, -1 if there is no burst
+	int16_t _notifyIndex = -1;
+
 	char _schemaURL[SSDP_SCHEMA_URL_SIZE];
 	char _uuid[SSDP_UUID_SIZE];
 	// Device type is stored with domain name and version